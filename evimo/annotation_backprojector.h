@@ -13,6 +13,7 @@
 
 class Backprojector {
 protected:
+    std::shared_ptr<Dataset> dataset;
     double timestamp;
     double window_size;
     std::vector<DatasetFrame> frames;
@@ -22,8 +23,8 @@ protected:
     pcl::KdTreeFLANN<pcl::PointXYZRGB> epc_kdtree;
 
 public:
-    Backprojector(double timestamp, double window_size, double framerate)
-        : timestamp(timestamp), window_size(window_size)
+    Backprojector(std::shared_ptr<Dataset> dataset, double timestamp, double window_size, double framerate)
+        : dataset(dataset), timestamp(timestamp), window_size(window_size)
         , event_pc(new pcl::PointCloud<pcl::PointXYZRGB>)
         , event_pc_roi(new pcl::PointCloud<pcl::PointXYZRGB>)
         , mask_pc(new pcl::PointCloud<pcl::PointXYZRGB>) {
@@ -33,11 +34,11 @@ public:
         std::pair<uint64_t, uint64_t> last_event_slice_ids(0, 0);
         for (double ts = std::max(0.0, timestamp - window_size / 2.0);
             ts < timestamp + window_size / 2.0; ts += 1.0 / framerate) {
-            frames.emplace_back(last_cam_pos_id, ts, i);
+            frames.emplace_back(this->dataset, last_cam_pos_id, ts, i);
             auto &frame = frames.back();
             last_cam_pos_id = frame.cam_pose_id;
 
-            for (auto &obj_tj : Dataset::obj_tjs) {
+            for (auto &obj_tj : this->dataset->obj_tjs) {
                 frame.add_object_pos_id(obj_tj.first, frame.cam_pose_id);
             }
 
@@ -55,7 +56,7 @@ public:
 
     void refresh_ec() {
         this->event_pc->clear();
-        auto e_slice = TimeSlice(Dataset::event_array,
+        auto e_slice = TimeSlice(this->dataset->event_array,
           std::make_pair(std::max(0.0, this->timestamp - this->window_size / 2.0), this->timestamp + this->window_size / 2.0),
           std::make_pair(this->frames.front().event_slice_ids.first, this->frames.back().event_slice_ids.second));
         for (auto &e : e_slice) {
@@ -148,37 +149,37 @@ public:
         //std::valarray<float> T = {0, 0, 0};
         //std::valarray<float> R = {0, 0, 0};
 
-        Dataset::set_sliders(0.001, 0, 0, 0, 0, 0);
+        this->dataset->set_sliders(0.001, 0, 0, 0, 0, 0);
         generate();
 
         if (this->inverse_score() > initial) {
-            Dataset::set_sliders(-0.002, 0, 0, 0, 0, 0);
+            this->dataset->set_sliders(-0.002, 0, 0, 0, 0, 0);
             generate();
         }
 
         if (this->inverse_score() > initial) {
-            Dataset::set_sliders(0.001, 0, 0, 0, 0, 0);
+            this->dataset->set_sliders(0.001, 0, 0, 0, 0, 0);
             generate();
         }
 
-        Dataset::set_sliders(0, 0.001, 0, 0, 0, 0);
+        this->dataset->set_sliders(0, 0.001, 0, 0, 0, 0);
         generate();
 
         if (this->inverse_score() > initial) {
-            Dataset::set_sliders(0, -0.002, 0, 0, 0, 0);
+            this->dataset->set_sliders(0, -0.002, 0, 0, 0, 0);
             generate();
         }
 
         if (this->inverse_score() > initial) {
-            Dataset::set_sliders(0, 0.001, 0, 0, 0, 0);
+            this->dataset->set_sliders(0, 0.001, 0, 0, 0, 0);
             generate();
         }
 
         std::cout << "Score (after): " << this->score() << "\t" << this->inverse_score() << "\n";
 
-//        Dataset::set_sliders(0.0, 0.001, 0, 0, 0, 0);
+//        this->dataset->set_sliders(0.0, 0.001, 0, 0, 0, 0);
 //        if (this->inverse_score() < initial)
-//            Dataset::set_sliders(0.0, -0.002, 0, 0, 0, 0);
+//            this->dataset->set_sliders(0.0, -0.002, 0, 0, 0, 0);
 
 /*
         std::vector<int> pointIdxRadiusSearch(1);
@@ -190,8 +191,8 @@ public:
             auto &p_mask = this->mask_pc->at(pointIdxRadiusSearch[0]);
 
             pcl::PointXYZ p_src, p_tgt;
-            DatasetFrame::unproject_point(p_src, p.x * 200, p.y * 200);
-            DatasetFrame::unproject_point(p_tgt, p_mask.x * 200, p_mask.y * 200);
+            this->frames.front().unproject_point(p_src, p.x * 200, p.y * 200);
+            this->frames.front().unproject_point(p_tgt, p_mask.x * 200, p_mask.y * 200);
 
             //std::cout << "(" << p_src.x << ";\t" << p_src.y << ")\t->\t"
             //          << "(" << p_tgt.x << ";\t" << p_tgt.y << ")\n";
@@ -211,7 +212,7 @@ public:
         std::cout << "T = " << T[0] << "\t" << T[1] << "\t" << T[2] << "\n";
         std::cout << "R = " << R[0] << "\t" << R[1] << "\t" << R[2] << "\n\n";
 
-        Dataset::set_sliders(T[0], T[1], T[2], R[0], R[1], R[2]);
+        this->dataset->set_sliders(T[0], T[1], T[2], R[0], R[1], R[2]);
         */
     }
 
@@ -219,6 +220,7 @@ public:
         this->mask_pc->clear();
 
         // Mask trace cloud
+        this->dataset->apply_settings();
         for (auto &f : this->frames) f.generate_async();
         for (auto &f : this->frames) f.join();
 
@@ -0,0 +1,105 @@
+#ifndef BAG_READER_H
+#define BAG_READER_H
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <exception>
+
+#include <ros/ros.h>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+
+
+// Multi-threaded bag reader: the time range of the requested topics is split
+// into consecutive intervals, and every worker thread opens its own
+// rosbag::Bag and decompresses / deserializes the messages of one interval at
+// a time. Each interval is decoded into its own Part; the parts are returned
+// in time order, so merging them in order gives the same message order as a
+// single View over the whole bag.
+template <class Part> class ParallelBagReader {
+protected:
+    std::string fname;
+    std::vector<std::string> topics;
+    size_t n_threads, n_intervals;
+
+public:
+    ParallelBagReader(std::string fname_, std::vector<std::string> topics_, size_t n_threads_ = 0)
+        : fname(fname_), topics(topics_), n_threads(n_threads_) {
+        if (this->n_threads == 0)
+            this->n_threads = std::max(std::thread::hardware_concurrency(), 1u);
+        // More intervals than threads, so a dense stretch of the bag does not stall one worker
+        this->n_intervals = this->n_threads == 1 ? 1 : this->n_threads * 4;
+    }
+
+    // 'decode' is called for every message of an interval, in order:
+    //     void decode(const rosbag::MessageInstance &m, Part &part)
+    template <class F> std::vector<Part> read(F decode) {
+        return this->read_until([&decode](const rosbag::MessageInstance &m, Part &part) {
+            decode(m, part);
+            return true;
+        });
+    }
+
+    // As read(), but 'decode' returns false once the rest of the bag is not
+    // needed: the remaining messages of that interval and the later intervals
+    // are skipped, and the parts end with the earliest interval that stopped
+    //     bool decode(const rosbag::MessageInstance &m, Part &part)
+    template <class F> std::vector<Part> read_until(F decode) {
+        rosbag::Bag bag;
+        bag.open(this->fname, rosbag::bagmode::Read);
+        rosbag::View full_view(bag, rosbag::TopicQuery(this->topics));
+        if (full_view.size() == 0) return std::vector<Part>();
+
+        uint64_t t_begin = full_view.getBeginTime().toNSec();
+        uint64_t t_end   = full_view.getEndTime().toNSec();
+        bag.close();
+
+        // Interval k is [bounds[k], bounds[k + 1] - 1ns]; View time bounds are inclusive
+        std::vector<uint64_t> bounds;
+        for (size_t k = 0; k < this->n_intervals; ++k)
+            bounds.push_back(t_begin + (t_end - t_begin) / this->n_intervals * k);
+        bounds.push_back(t_end + 1);
+        bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+
+        std::vector<Part> parts(bounds.size() - 1);
+        std::atomic<size_t> next_interval(0), last_interval(parts.size() - 1);
+        std::vector<std::exception_ptr> errors(this->n_threads);
+
+        auto worker = [&](size_t thread_id) {
+            try {
+                rosbag::Bag worker_bag;
+                worker_bag.open(this->fname, rosbag::bagmode::Read);
+                for (size_t k = next_interval++; k < parts.size() && k <= last_interval; k = next_interval++) {
+                    rosbag::View view(worker_bag, rosbag::TopicQuery(this->topics),
+                                      ros::Time().fromNSec(bounds[k]), ros::Time().fromNSec(bounds[k + 1] - 1));
+                    for (auto &m : view) {
+                        if (decode(m, parts[k])) continue;
+                        size_t last = last_interval;
+                        while (k < last && !last_interval.compare_exchange_weak(last, k));
+                        break;
+                    }
+                }
+                worker_bag.close();
+            } catch (...) {
+                errors[thread_id] = std::current_exception();
+                next_interval = parts.size();
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < std::min(this->n_threads, parts.size()); ++i)
+            threads.emplace_back(worker, i);
+        for (auto &t : threads) t.join();
+
+        for (auto &e : errors)
+            if (e) std::rethrow_exception(e);
+        parts.resize(last_interval + 1);
+        return parts;
+    }
+};
+
+
+#endif // BAG_READER_H
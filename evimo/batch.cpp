@@ -0,0 +1,272 @@
+#include <map>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <exception>
+#include <condition_variable>
+#include <unistd.h>
+#include <boost/filesystem.hpp>
+
+#include <ros/ros.h>
+#include <ros/package.h>
+
+// Local includes
+#include <common.h>
+#include <sequence.h>
+#include <model_store.h>
+#include <thread_pool.h>
+
+
+// Ground truth generation for many dataset folders in one process:
+//
+//   rosrun evimo datagen_batch [_param:=value ...] folder1 folder2 ...
+//
+// Parameters use the rosrun syntax and are the private parameters of
+// datagen_offline (see read_sequence_params()), applied to every folder, plus:
+//   _list:=file       more folders, one per line
+//   _threads:=N       global thread budget; 0 - all cores
+//   _jobs:=N          sequences processed at once; 0 - threads / 4
+//   _memory_gb:=X     memory budget; 0 - half of the physical memory
+//   _objects:=dir     model folder; evimo/objects by default
+//   _stream_window:=S window for the sequences which do not fit the budget
+// No ROS master is needed. The models are loaded once and shared, the thread
+// pool is shared by the frame rendering of all sequences, and the threads each
+// sequence starts on its own (bag decoding, PNG encoding, events.txt
+// formatting) default to its share of _threads. A
+// sequence is started only when its memory estimate (the size of its bag) fits
+// in what is left of the budget; bags larger than the whole budget are streamed
+struct BatchJob {
+    size_t order;
+    std::string folder;
+    uint64_t bag_bytes = 0;
+    uint64_t memory = 0;
+    bool stream = false;
+
+    int ret = -1;
+    std::string error;
+    SequenceStats stats;
+};
+
+
+// Value of a '_name:=value' argument
+template <class T> bool parse_param(const std::string &str, T &value) {
+    std::istringstream ss(str);
+    T v;
+    if (!(ss >> v)) return false;
+    value = v;
+    return true;
+}
+
+template <> bool parse_param(const std::string &str, bool &value) {
+    if (str == "true" || str == "True" || str == "1") value = true;
+    else if (str == "false" || str == "False" || str == "0") value = false;
+    else return false;
+    return true;
+}
+
+template <> bool parse_param(const std::string &str, std::string &value) {
+    value = str;
+    return true;
+}
+
+
+int main (int argc, char** argv) {
+    std::map<std::string, std::string> args;
+    std::vector<std::string> folders;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto sep = arg.find(":=");
+        if (arg.size() > 1 && arg[0] == '_' && sep != std::string::npos)
+            args[arg.substr(1, sep - 1)] = arg.substr(sep + 2);
+        else
+            folders.push_back(arg);
+    }
+
+    auto get = [&](const std::string &name, auto &value) {
+        auto it = args.find(name);
+        if (it == args.end()) return false;
+        if (parse_param(it->second, value)) return true;
+        std::cerr << _red("Can not parse parameter ") << name << ": " << it->second << std::endl;
+        return false;
+    };
+
+    std::string list = "";
+    if (get("list", list)) {
+        std::ifstream ifs(list, std::ifstream::in);
+        if (!ifs.is_open()) {
+            std::cerr << _red("Could not open the folder list ") << list << std::endl;
+            return -1;
+        }
+        std::string line;
+        while (std::getline(ifs, line)) {
+            line.erase(0, line.find_first_not_of(" \t"));
+            line.erase(line.find_last_not_of(" \t\r") + 1);
+            if (line != "" && line[0] != '#') folders.push_back(line);
+        }
+    }
+
+    if (folders.size() == 0) {
+        std::cerr << "No dataset folders specified!" << std::endl;
+        return -1;
+    }
+
+    int threads = 0, jobs = 0;
+    float memory_gb = 0, stream_window = 10.0;
+    get("threads", threads);
+    get("jobs", jobs);
+    get("memory_gb", memory_gb);
+    get("stream_window", stream_window);
+    if (threads <= 0) threads = std::max(std::thread::hardware_concurrency(), 1u);
+    if (jobs <= 0) jobs = std::max(threads / 4, 1);
+    jobs = std::min(jobs, int(folders.size()));
+
+    uint64_t memory = memory_gb * 1e9;
+    if (memory == 0) memory = uint64_t(sysconf(_SC_PHYS_PAGES)) * sysconf(_SC_PAGE_SIZE) / 2;
+
+    std::string objects = "";
+    if (!get("objects", objects)) objects = ros::package::getPath("evimo") + "/objects";
+
+    // The same settings for every sequence; the per-sequence thread counts
+    // default to a share of the budget
+    SequenceParams base;
+    read_sequence_params(get, base);
+    base.generate = true;
+    base.show = -1;
+    base.verbose = false;
+    if (base.bag_threads <= 0) base.bag_threads = std::max(threads / jobs, 1);
+    if (base.render_threads <= 0) base.render_threads = std::max(threads / jobs, 1);
+    if (base.encode_threads <= 0) base.encode_threads = std::max(threads / (2 * jobs), 1);
+    if (base.writer_threads <= 0) base.writer_threads = std::max(threads / jobs, 1);
+
+    // ros::Time is used without a node
+    ros::Time::init();
+    ThreadPool::shared(threads);
+    ModelStore models(objects);
+
+    std::vector<BatchJob> queue(folders.size());
+    for (size_t i = 0; i < folders.size(); ++i) {
+        auto &job = queue[i];
+        job.order = i;
+        job.folder = folders[i];
+        boost::system::error_code ec;
+        job.bag_bytes = boost::filesystem::file_size(sequence_bag_path(job.folder), ec);
+        if (ec) job.bag_bytes = 0;
+
+        job.memory = job.bag_bytes;
+        job.stream = base.window > 0 || job.memory > memory;
+        if (job.stream) job.memory = memory / jobs;
+    }
+
+    // Longest first, so that the big sequences do not end up running alone at the end
+    std::stable_sort(queue.begin(), queue.end(), [](const BatchJob &a, const BatchJob &b) {
+        return a.bag_bytes > b.bag_bytes; });
+
+    std::cout << _blue("Processing ") << queue.size() << _blue(" sequences, ") << jobs << _blue(" at once, with ")
+              << threads << _blue(" threads and ") << memory / 1e9 << _blue(" GB") << std::endl;
+
+    std::mutex lock;
+    std::condition_variable done;
+    std::vector<bool> started(queue.size(), false);
+    uint64_t memory_used = 0;
+    size_t running = 0, n_started = 0, n_finished = 0;
+
+    auto wall_start = std::chrono::steady_clock::now();
+    auto worker = [&]() {
+        while (true) {
+            size_t id = queue.size();
+            {
+                // The largest sequence which fits; any if nothing else is running
+                std::unique_lock<std::mutex> guard(lock);
+                done.wait(guard, [&]() {
+                    if (n_started == queue.size()) return true;
+                    for (size_t i = 0; i < queue.size(); ++i) {
+                        if (started[i] || (running > 0 && memory_used + queue[i].memory > memory)) continue;
+                        id = i;
+                        return true;
+                    }
+                    return false;
+                });
+                if (id == queue.size()) return;
+
+                started[id] = true;
+                n_started ++;
+                running ++;
+                memory_used += queue[id].memory;
+                std::cout << _blue("[batch] started ") << queue[id].folder
+                          << (queue[id].stream ? _yellow(" (streamed)") : std::string()) << std::endl;
+            }
+
+            auto &job = queue[id];
+            SequenceParams p = base;
+            p.folder = job.folder;
+            if (job.stream && p.window <= 0) p.window = stream_window;
+            try {
+                job.ret = run_sequence(p, models, &job.stats);
+            } catch (const std::exception &e) {
+                job.ret = -1;
+                job.error = e.what();
+            }
+
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                running --;
+                n_finished ++;
+                memory_used -= job.memory;
+                auto &s = job.stats;
+                if (job.ret == 0) {
+                    std::cout << _green("[batch] ") << n_finished << "/" << queue.size() << " " << job.folder << ": "
+                              << s.frames << " frames in " << s.seconds << " s, "
+                              << s.frames / std::max(s.seconds, 1e-9) << " fps, "
+                              << s.bag_bytes / 1e6 / std::max(s.seconds, 1e-9) << " MB/s" << std::endl;
+                } else {
+                    std::cout << _red("[batch] ") << n_finished << "/" << queue.size() << " " << job.folder
+                              << _red(" failed ") << job.error << std::endl;
+                }
+            }
+            done.notify_all();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < jobs; ++i)
+        workers.emplace_back(worker);
+    for (auto &t : workers) t.join();
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+
+    // Per-sequence throughput, in the order of the input
+    std::sort(queue.begin(), queue.end(), [](const BatchJob &a, const BatchJob &b) {return a.order < b.order; });
+
+    uint64_t total_frames = 0, total_bytes = 0, n_failed = 0;
+    double total_seconds = 0;
+    std::cout << std::endl << _blue("Summary:") << std::endl;
+    std::cout << "\tframes\tevents\ttime, s\tfps\tMB/s\tsequence" << std::endl;
+    for (auto &job : queue) {
+        auto &s = job.stats;
+        if (job.ret != 0) {
+            n_failed ++;
+            std::cout << "\t" << _red("failed") << "\t\t\t\t\t" << job.folder << std::endl;
+            continue;
+        }
+        total_frames += s.frames;
+        total_bytes += s.bag_bytes;
+        total_seconds += s.seconds;
+        std::cout << std::fixed << std::setprecision(1)
+                  << "\t" << s.frames << "\t" << s.events << "\t" << s.seconds
+                  << "\t" << s.frames / std::max(s.seconds, 1e-9)
+                  << "\t" << s.bag_bytes / 1e6 / std::max(s.seconds, 1e-9)
+                  << "\t" << job.folder << std::endl;
+    }
+
+    std::cout << std::endl << _green("Done ") << queue.size() - n_failed << "/" << queue.size()
+              << _green(" sequences in ") << wall << " s: " << total_frames / std::max(wall, 1e-9) << " fps, "
+              << total_bytes / 1e6 / std::max(wall, 1e-9) << " MB/s, "
+              << total_seconds / std::max(wall, 1e-9) << _green(" sequences at a time on average") << std::endl;
+    return n_failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,62 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <deque>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+
+
+// Blocking FIFO between pipeline stages: push() waits while the queue is full,
+// pop() waits while it is empty. After close() the remaining items can still
+// be popped, then pop() returns false and push() drops the item
+template <class T> class BoundedQueue {
+protected:
+    std::deque<T> items;
+    size_t capacity;
+    bool closed;
+
+    std::mutex lock;
+    std::condition_variable not_empty, not_full;
+
+public:
+    BoundedQueue (size_t capacity_) : capacity(std::max(capacity_, size_t(1))), closed(false) {}
+
+    BoundedQueue (const BoundedQueue&) = delete;
+    BoundedQueue& operator = (const BoundedQueue&) = delete;
+
+    bool push (T item) {
+        {
+            std::unique_lock<std::mutex> guard(this->lock);
+            this->not_full.wait(guard, [this]() {return this->closed || this->items.size() < this->capacity; });
+            if (this->closed) return false;
+            this->items.push_back(std::move(item));
+        }
+        this->not_empty.notify_one();
+        return true;
+    }
+
+    bool pop (T &item) {
+        {
+            std::unique_lock<std::mutex> guard(this->lock);
+            this->not_empty.wait(guard, [this]() {return this->closed || !this->items.empty(); });
+            if (this->items.empty()) return false;
+            item = std::move(this->items.front());
+            this->items.pop_front();
+        }
+        this->not_full.notify_one();
+        return true;
+    }
+
+    void close () {
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->closed = true;
+        }
+        this->not_empty.notify_all();
+        this->not_full.notify_all();
+    }
+};
+
+
+#endif // BOUNDED_QUEUE_H
@@ -0,0 +1,222 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <cmath>
+#include <limits>
+#include <cstdint>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <tuple>
+
+#include <point_buffer.h>
+
+
+// Bounding volume hierarchy over a PointBuffer, used to skip the parts of a
+// model which are outside of the camera view. build() reorders the points so
+// that every node covers a contiguous range of them.
+//
+// Every leaf also holds a voxel grid level of detail pyramid: level k keeps one
+// point per voxel of side LOD_VOXEL * 2^(k - 1) (level 0 keeps all points), and
+// the points of a leaf are sorted from coarse to fine, so every level is a prefix
+// of the leaf range
+class PointBVH {
+public:
+    static constexpr int LOD_LEVELS = 8;
+    static constexpr float LOD_VOXEL = 0.002; // meters, level 1
+
+    struct Node {
+        float lo[3], hi[3];
+        uint32_t first, count;
+        int32_t left, right; // -1 for leaves
+        uint32_t lod_count[LOD_LEVELS];
+    };
+
+protected:
+    std::vector<Node> nodes;
+
+public:
+    inline size_t size () const {return this->nodes.size(); }
+
+    void build (PointBuffer &pts, size_t leaf_size = 512) {
+        this->nodes.clear();
+        if (pts.size() == 0) return;
+
+        std::vector<uint32_t> order(pts.size());
+        std::iota(order.begin(), order.end(), 0);
+        this->build_node(pts, order, 0, pts.size(), std::max(leaf_size, size_t(1)));
+
+        PointBuffer sorted;
+        sorted.resize(pts.size());
+        for (size_t i = 0; i < order.size(); ++i) {
+            sorted.x()[i] = pts.x()[order[i]];
+            sorted.y()[i] = pts.y()[order[i]];
+            sorted.z()[i] = pts.z()[order[i]];
+        }
+        pts = std::move(sorted);
+
+        for (auto &node : this->nodes)
+            if (node.left < 0) this->build_lod(pts, node);
+    }
+
+    // Voxel side of a level of detail, in meters
+    static float lod_voxel (int level) {
+        return (level == 0) ? 0 : LOD_VOXEL * float(1 << (level - 1));
+    }
+
+    // Calls f(first, count) for the point ranges which may be visible. 'm' is the
+    // row-major 3x4 model to camera matrix, with z pointing away from the camera.
+    // A node is skipped when all of it is closer than z_near, or outside one of
+    // the planes |x| = r * z, |y| = r * z; r = inf disables the side planes.
+    //
+    // With a focal length (in pixels) > 0 only the level of detail prefix of a
+    // leaf is passed: the coarsest level whose voxel still projects to at most
+    // half a pixel at the nearest corner of the leaf box, so that the voxel and
+    // pixel grids being misaligned does not leave holes
+    template <class F> void visible (const float *m, float z_near, float r, F f, float focal = 0) const {
+        const float view[4] = {-r, r, -r, r};
+        this->visible(m, z_near, view, f, focal);
+    }
+
+    // The same for an off-center view: the planes x = view[0] * z, x = view[1] * z,
+    // y = view[2] * z, y = view[3] * z; infinite bounds disable their planes
+    template <class F> void visible (const float *m, float z_near, const float *view, F f, float focal = 0) const {
+        if (this->nodes.empty()) return;
+
+        std::vector<int32_t> stack = {0};
+        while (!stack.empty()) {
+            auto &node = this->nodes[stack.back()];
+            stack.pop_back();
+            if (this->outside(node, m, z_near, view)) continue;
+
+            if (node.left < 0) {
+                f(node.first, (focal > 0) ? node.lod_count[this->lod_level(node, m, z_near, focal)] : node.count);
+                continue;
+            }
+
+            stack.push_back(node.right);
+            stack.push_back(node.left);
+        }
+    }
+
+protected:
+    int32_t build_node (const PointBuffer &pts, std::vector<uint32_t> &order, size_t first, size_t last,
+                        size_t leaf_size) {
+        Node node;
+        for (int k = 0; k < 3; ++k) {
+            node.lo[k] = std::numeric_limits<float>::max();
+            node.hi[k] = std::numeric_limits<float>::lowest();
+        }
+
+        const float *c[3] = {pts.x(), pts.y(), pts.z()};
+        for (size_t i = first; i < last; ++i) {
+            for (int k = 0; k < 3; ++k) {
+                node.lo[k] = std::min(node.lo[k], c[k][order[i]]);
+                node.hi[k] = std::max(node.hi[k], c[k][order[i]]);
+            }
+        }
+
+        node.first = first;
+        node.count = last - first;
+        node.left = node.right = -1;
+        std::fill(node.lod_count, node.lod_count + LOD_LEVELS, node.count);
+
+        int32_t id = this->nodes.size();
+        this->nodes.push_back(node);
+        if (last - first <= leaf_size) return id;
+
+        // Median split along the longest side
+        int axis = 0;
+        for (int k = 1; k < 3; ++k)
+            if (node.hi[k] - node.lo[k] > node.hi[axis] - node.lo[axis]) axis = k;
+
+        size_t mid = first + (last - first) / 2;
+        std::nth_element(order.begin() + first, order.begin() + mid, order.begin() + last,
+                         [&](uint32_t a, uint32_t b) {return c[axis][a] < c[axis][b]; });
+
+        int32_t left  = this->build_node(pts, order, first, mid, leaf_size);
+        int32_t right = this->build_node(pts, order, mid, last, leaf_size);
+        this->nodes[id].left  = left;
+        this->nodes[id].right = right;
+        return id;
+    }
+
+    // Level of every point of the leaf: the coarsest level at which it is the first
+    // point in its voxel; the voxels of the coarser levels stay occupied
+    void build_lod (PointBuffer &pts, Node &node) {
+        std::vector<uint8_t> level(node.count, 0);
+
+        // (voxel, already placed on a coarser level ? 0 : 1, index), sorted: the
+        // first entry of every voxel decides
+        std::vector<std::tuple<uint64_t, int, uint32_t>> cells(node.count);
+        for (int k = LOD_LEVELS - 1; k > 0; --k) {
+            float s = lod_voxel(k);
+            for (uint32_t i = 0; i < node.count; ++i) {
+                size_t j = node.first + i;
+                uint64_t kx = uint64_t(int64_t(std::floor(pts.x()[j] / s))) & 0x1fffff;
+                uint64_t ky = uint64_t(int64_t(std::floor(pts.y()[j] / s))) & 0x1fffff;
+                uint64_t kz = uint64_t(int64_t(std::floor(pts.z()[j] / s))) & 0x1fffff;
+                cells[i] = std::make_tuple((kx << 42) | (ky << 21) | kz, (level[i] > k) ? 0 : 1, i);
+            }
+
+            std::sort(cells.begin(), cells.end());
+            for (size_t i = 0; i < cells.size(); ++i) {
+                if (i > 0 && std::get<0>(cells[i]) == std::get<0>(cells[i - 1])) continue;
+                if (std::get<1>(cells[i]) == 1) level[std::get<2>(cells[i])] = k;
+            }
+        }
+
+        std::vector<uint32_t> order(node.count);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {return level[a] > level[b]; });
+
+        std::vector<float> c(node.count);
+        for (float *col : {pts.x(), pts.y(), pts.z()}) {
+            for (size_t i = 0; i < node.count; ++i) c[i] = col[node.first + order[i]];
+            std::copy(c.begin(), c.end(), col + node.first);
+        }
+
+        for (int k = 0; k < LOD_LEVELS; ++k)
+            node.lod_count[k] = std::count_if(level.begin(), level.end(), [k](uint8_t l) {return l >= k; });
+    }
+
+    static int lod_level (const Node &node, const float *m, float z_near, float focal) {
+        double z = std::numeric_limits<double>::max();
+        for (int i = 0; i < 8; ++i) {
+            float x = (i & 1) ? node.hi[0] : node.lo[0];
+            float y = (i & 2) ? node.hi[1] : node.lo[1];
+            float z_ = (i & 4) ? node.hi[2] : node.lo[2];
+            z = std::min(z, double(m[8]) * x + double(m[9]) * y + double(m[10]) * z_ + m[11]);
+        }
+
+        if (z < z_near) return 0;
+        int k = LOD_LEVELS - 1;
+        while (k > 0 && 2 * lod_voxel(k) * focal > z) --k;
+        return k;
+    }
+
+    // The box is convex and the tests are linear, so checking its corners is enough
+    static bool outside (const Node &node, const float *m, float z_near, const float *view) {
+        bool near = true, px = !std::isinf(view[1]), nx = !std::isinf(view[0]);
+        bool py = !std::isinf(view[3]), ny = !std::isinf(view[2]);
+        for (int i = 0; i < 8; ++i) {
+            float x = (i & 1) ? node.hi[0] : node.lo[0];
+            float y = (i & 2) ? node.hi[1] : node.lo[1];
+            float z = (i & 4) ? node.hi[2] : node.lo[2];
+            double cx = double(m[0]) * x + double(m[1]) * y + double(m[2])  * z + m[3];
+            double cy = double(m[4]) * x + double(m[5]) * y + double(m[6])  * z + m[7];
+            double cz = double(m[8]) * x + double(m[9]) * y + double(m[10]) * z + m[11];
+
+            near = near && (cz < z_near);
+            px = px && (cx > view[1] * cz);
+            nx = nx && (cx < view[0] * cz);
+            py = py && (cy > view[3] * cz);
+            ny = ny && (cy < view[2] * cz);
+        }
+
+        return near || px || nx || py || ny;
+    }
+};
+
+
+#endif // BVH_H
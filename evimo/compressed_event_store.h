@@ -0,0 +1,418 @@
+#ifndef COMPRESSED_EVENT_STORE_H
+#define COMPRESSED_EVENT_STORE_H
+
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <unordered_map>
+
+#include <common.h>
+#include <event_store.h>
+
+
+// Compressed event container with the same read interface as EventStore.
+// Events are kept in blocks of up to BLOCK events; a block stores zigzag
+// varint timestamp deltas, x and y bit-packed to the width of the block's
+// largest value, and a polarity bitset, plus the min / max timestamp.
+// Blocks are decoded on access into EventStores; a small LRU cache of
+// decoded blocks is shared between threads, every thread additionally
+// remembers the last block it used. New events are appended to an
+// uncompressed tail, which is sealed into a block once full.
+class CompressedEventStore {
+public:
+    static constexpr size_t BLOCK = 4096;
+
+    typedef EventStore::EventView EventView;
+    typedef EventView value_type;
+
+protected:
+    struct Block {
+        size_t first;                  // index of the first event in the block
+        uint32_t count;
+        uint8_t x_bits, y_bits;
+        ull t_first, t_min, t_max;
+        std::vector<uint8_t> data;     // ts deltas | packed x | packed y | polarity
+        uint32_t xy_offset;            // start of the 8-byte aligned packed data
+    };
+
+    std::vector<Block> blocks;
+    EventStore tail;
+    size_t sealed;
+
+    // Decoded blocks; 'generation' changes whenever existing blocks are modified
+    mutable std::mutex cache_mutex;
+    mutable std::list<size_t> lru;
+    mutable std::unordered_map<size_t, std::pair<std::shared_ptr<const EventStore>,
+                                                 std::list<size_t>::iterator>> cache;
+    size_t max_cached_blocks;
+    uint64_t generation;
+
+public:
+    CompressedEventStore (size_t max_cached_blocks_ = 256)
+        : sealed(0), max_cached_blocks(std::max(max_cached_blocks_, size_t(1))),
+          generation(next_generation()) {}
+
+    CompressedEventStore (CompressedEventStore &&other)
+        : CompressedEventStore(other.max_cached_blocks) {
+        *this = std::move(other);
+    }
+
+    CompressedEventStore &operator= (CompressedEventStore &&other) {
+        if (this == &other) return *this;
+        this->blocks = std::move(other.blocks);
+        this->tail = std::move(other.tail);
+        this->sealed = other.sealed;
+        this->max_cached_blocks = other.max_cached_blocks;
+        other.clear();
+        this->modified();
+        return *this;
+    }
+
+    CompressedEventStore (const CompressedEventStore&) = delete;
+    CompressedEventStore &operator= (const CompressedEventStore&) = delete;
+
+    inline size_t size () const {return this->sealed + this->tail.size(); }
+    inline bool empty () const {return this->size() == 0; }
+
+    void clear () {
+        this->blocks.clear();
+        this->tail.clear();
+        this->sealed = 0;
+        this->modified();
+    }
+
+    // The block headers already act as a time index
+    void reserve (size_t) {}
+    void build_time_index (ull) {}
+    bool has_time_index () const {return true; }
+
+    inline void push_back (uint x, uint y, ull t, char pol) {
+        this->tail.push_back(x, y, t, pol);
+        if (this->tail.size() >= BLOCK) this->seal();
+    }
+
+    inline void push_back (const Event &e) {
+        this->push_back(e.fr_x, e.fr_y, e.timestamp, e.polarity);
+    }
+
+    void append (const EventStore &other) {
+        for (size_t i = 0; i < other.size(); ++i)
+            this->push_back(other.get_x(i), other.get_y(i), other.get_ts(i), other.get_polarity(i));
+    }
+
+    // Moves the blocks of 'other' without re-encoding them; the tail of this
+    // store is sealed first into a (shorter) block
+    void append (CompressedEventStore &&other) {
+        if (this->tail.size() > 0) this->seal();
+        for (auto &b : other.blocks) {
+            b.first = this->sealed;
+            this->sealed += b.count;
+            this->blocks.push_back(std::move(b));
+        }
+
+        this->tail = std::move(other.tail);
+        other.clear();
+    }
+
+    // For use as a builder, like EventStoreBuilder
+    void append_to (CompressedEventStore &store) {store.append(std::move(*this)); }
+
+    void finalize (CompressedEventStore &store) {
+        store.clear();
+        this->append_to(store);
+    }
+
+    // Shift all timestamps back by t (nanoseconds); deltas are unaffected
+    void subtract_time (ull t) {
+        for (auto &b : this->blocks) {
+            b.t_first -= t;
+            b.t_min -= t;
+            b.t_max -= t;
+        }
+        this->tail.subtract_time(t);
+        this->modified();
+    }
+
+    // Column accessors
+    inline uint get_x (size_t idx) const {auto l = this->locate(idx); return l.first->get_x(l.second); }
+    inline uint get_y (size_t idx) const {auto l = this->locate(idx); return l.first->get_y(l.second); }
+    inline ull  get_ts (size_t idx) const {auto l = this->locate(idx); return l.first->get_ts(l.second); }
+    inline char get_polarity (size_t idx) const {auto l = this->locate(idx); return l.first->get_polarity(l.second); }
+    inline double get_ts_sec (size_t idx) const {return (long double)this->get_ts(idx) / 1000000000.0; }
+
+    inline EventView operator [] (size_t idx) const {
+        auto loc = this->locate(idx);
+        return (*loc.first)[loc.second];
+    }
+
+    // A search hint for TimeSlice (see EventStore::index_hint): the event
+    // right before the last block that starts at or before ts_sec
+    size_t index_hint (double ts_sec, size_t hint) const {
+        if (this->size() == 0) return hint;
+
+        double ns = ts_sec * 1000000000.0;
+        if (this->tail.size() > 0 && ns >= double(this->tail.get_ts(0)))
+            return this->sealed > 0 ? this->sealed - 1 : 0;
+        if (this->blocks.size() == 0 || ns <= double(this->blocks[0].t_min)) return 0;
+
+        auto it = std::upper_bound(this->blocks.begin(), this->blocks.end(), ns,
+            [](double v, const Block &b) {return v < double(b.t_min); });
+        size_t first = (it - 1)->first;
+        return first > 0 ? first - 1 : 0;
+    }
+
+    size_t memory_usage () const {
+        size_t ret = this->tail.memory_usage() + this->blocks.capacity() * sizeof(Block);
+        for (auto &b : this->blocks) ret += b.data.capacity();
+
+        std::lock_guard<std::mutex> lock(this->cache_mutex);
+        for (auto &c : this->cache) ret += c.second.first->memory_usage();
+        return ret;
+    }
+
+    inline auto begin() const {return _CESiterator(this, 0); }
+    inline auto end()   const {return _CESiterator(this, this->size()); }
+
+protected:
+    static uint64_t next_generation() {
+        static std::atomic<uint64_t> counter(0);
+        return ++counter;
+    }
+
+    void modified() {
+        this->generation = next_generation();
+        std::lock_guard<std::mutex> lock(this->cache_mutex);
+        this->cache.clear();
+        this->lru.clear();
+    }
+
+    // Decoded events and the position of idx in them; every thread keeps the
+    // block it used last, so sequential access does not take the cache lock
+    std::pair<const EventStore*, size_t> locate (size_t idx) const {
+        assert(idx < this->size());
+        if (idx >= this->sealed)
+            return std::make_pair(&this->tail, idx - this->sealed);
+
+        struct LastBlock {
+            uint64_t generation = 0;
+            size_t first = 0, count = 0;
+            std::shared_ptr<const EventStore> events;
+        };
+        static thread_local LastBlock last;
+
+        if (last.generation != this->generation || idx - last.first >= last.count) {
+            size_t b = this->block_of(idx);
+            last.events = this->decoded(b);
+            last.generation = this->generation;
+            last.first = this->blocks[b].first;
+            last.count = this->blocks[b].count;
+        }
+
+        return std::make_pair(last.events.get(), idx - last.first);
+    }
+
+    inline size_t block_of (size_t idx) const {
+        auto it = std::upper_bound(this->blocks.begin(), this->blocks.end(), idx,
+            [](size_t v, const Block &b) {return v < b.first; });
+        return (it - this->blocks.begin()) - 1;
+    }
+
+    std::shared_ptr<const EventStore> decoded (size_t b) const {
+        {
+            std::lock_guard<std::mutex> lock(this->cache_mutex);
+            auto it = this->cache.find(b);
+            if (it != this->cache.end()) {
+                this->lru.splice(this->lru.begin(), this->lru, it->second.second);
+                return it->second.first;
+            }
+        }
+
+        // Decode outside of the lock; two threads may occasionally decode the same block
+        auto events = std::make_shared<EventStore>();
+        this->decode(this->blocks[b], *events);
+
+        std::lock_guard<std::mutex> lock(this->cache_mutex);
+        if (this->cache.find(b) == this->cache.end()) {
+            this->lru.push_front(b);
+            this->cache[b] = std::make_pair(events, this->lru.begin());
+            while (this->cache.size() > this->max_cached_blocks) {
+                this->cache.erase(this->lru.back());
+                this->lru.pop_back();
+            }
+        }
+        return events;
+    }
+
+    static uint8_t bits_for(uint v) {
+        uint8_t bits = 0;
+        while (v > 0) {bits ++; v >>= 1; }
+        return bits;
+    }
+
+    static void pack(const uint16_t *v, size_t n, uint8_t bits, std::vector<uint8_t> &out) {
+        std::vector<uint64_t> words((n * bits + 63) / 64, 0);
+        for (size_t i = 0; i < n && bits > 0; ++i) {
+            size_t pos = i * bits, w = pos / 64, o = pos % 64;
+            words[w] |= uint64_t(v[i]) << o;
+            if (o + bits > 64) words[w + 1] |= uint64_t(v[i]) >> (64 - o);
+        }
+
+        auto bytes = reinterpret_cast<const uint8_t*>(words.data());
+        out.insert(out.end(), bytes, bytes + words.size() * sizeof(uint64_t));
+    }
+
+    static const uint8_t *unpack(const uint8_t *p, size_t n, uint8_t bits, uint16_t *v) {
+        size_t n_words = (n * bits + 63) / 64;
+        std::vector<uint64_t> words(n_words);
+        std::memcpy(words.data(), p, n_words * sizeof(uint64_t));
+
+        uint64_t mask = (uint64_t(1) << bits) - 1;
+        for (size_t i = 0; i < n; ++i) {
+            if (bits == 0) {v[i] = 0; continue; }
+            size_t pos = i * bits, w = pos / 64, o = pos % 64;
+            uint64_t val = words[w] >> o;
+            if (o + bits > 64) val |= words[w + 1] << (64 - o);
+            v[i] = val & mask;
+        }
+        return p + n_words * sizeof(uint64_t);
+    }
+
+    // Encode the tail into a new block
+    void seal() {
+        size_t n = this->tail.size();
+        if (n == 0) return;
+
+        Block b;
+        b.first = this->sealed;
+        b.count = n;
+        auto ts = this->tail.ts_data();
+        b.t_first = b.t_min = b.t_max = ts[0];
+
+        uint max_x = 0, max_y = 0;
+        for (size_t i = 0; i < n; ++i) {
+            b.t_min = std::min(b.t_min, ts[i]);
+            b.t_max = std::max(b.t_max, ts[i]);
+            max_x = std::max(max_x, this->tail.get_x(i));
+            max_y = std::max(max_y, this->tail.get_y(i));
+        }
+        b.x_bits = bits_for(max_x);
+        b.y_bits = bits_for(max_y);
+
+        // zigzag varints, so unsorted timestamps still round-trip
+        b.data.reserve(n * 4);
+        for (size_t i = 1; i < n; ++i) {
+            int64_t d = int64_t(ts[i] - ts[i - 1]);
+            uint64_t zz = (uint64_t(d) << 1) ^ uint64_t(d >> 63);
+            while (zz >= 0x80) {
+                b.data.push_back(uint8_t(zz) | 0x80);
+                zz >>= 7;
+            }
+            b.data.push_back(uint8_t(zz));
+        }
+
+        b.data.resize((b.data.size() + 7) / 8 * 8, 0);
+        b.xy_offset = b.data.size();
+        pack(this->tail.x_data(), n, b.x_bits, b.data);
+        pack(this->tail.y_data(), n, b.y_bits, b.data);
+        auto pol = reinterpret_cast<const uint8_t*>(this->tail.polarity_data());
+        b.data.insert(b.data.end(), pol, pol + (n + 63) / 64 * sizeof(uint64_t));
+        b.data.shrink_to_fit();
+
+        this->blocks.push_back(std::move(b));
+        this->sealed += n;
+        this->tail.clear();
+    }
+
+    void decode(const Block &b, EventStore &out) const {
+        out.resize(b.count);
+        ull *ts = out.ts_col.mutable_data();
+        const uint8_t *p = b.data.data();
+
+        ts[0] = b.t_first;
+        for (size_t i = 1; i < b.count; ++i) {
+            uint64_t zz = 0;
+            int shift = 0;
+            while (*p & 0x80) {
+                zz |= uint64_t(*p++ & 0x7f) << shift;
+                shift += 7;
+            }
+            zz |= uint64_t(*p++) << shift;
+            ts[i] = ts[i - 1] + ull(int64_t(zz >> 1) ^ -int64_t(zz & 1));
+        }
+
+        p = b.data.data() + b.xy_offset;
+        p = unpack(p, b.count, b.x_bits, out.x_col.mutable_data());
+        p = unpack(p, b.count, b.y_bits, out.y_col.mutable_data());
+        std::memcpy(out.pol_col.mutable_data(), p, (b.count + 63) / 64 * sizeof(uint64_t));
+    }
+
+    // Keeps a reference to the decoded block it is in, so iterating does
+    // not go through the block cache for every event
+    class _CESiterator {
+    friend class CompressedEventStore;
+    public:
+        EventView& operator *() {this->load(); return this->view; }
+        EventView* operator->() {this->load(); return &(this->view); }
+
+        _CESiterator& operator ++() {
+            this->idx ++;
+            return *this;
+        }
+
+        _CESiterator operator +(size_t n) const {
+            return _CESiterator(this->store, this->idx + n);
+        }
+
+        bool operator !=(const _CESiterator &other) const {
+            return this->idx != other.idx;
+        }
+
+        bool operator ==(const _CESiterator &other) const {
+            return this->idx == other.idx;
+        }
+
+    protected:
+        _CESiterator(const CompressedEventStore *store_, size_t idx_)
+            : store(store_), idx(idx_), first(0), count(0) {}
+
+        inline void load() {
+            if (this->idx - this->first >= this->count) {
+                if (this->idx >= this->store->sealed) {
+                    this->events = nullptr;
+                    this->first = this->store->sealed;
+                    this->count = this->store->tail.size();
+                } else {
+                    size_t b = this->store->block_of(this->idx);
+                    this->events = this->store->decoded(b);
+                    this->first = this->store->blocks[b].first;
+                    this->count = this->store->blocks[b].count;
+                }
+            }
+
+            auto &e = this->events ? *this->events : this->store->tail;
+            this->view = e[this->idx - this->first];
+        }
+
+    private:
+        const CompressedEventStore *store;
+        size_t idx, first, count;
+        std::shared_ptr<const EventStore> events;
+        EventView view;
+    };
+};
+
+
+// The event container of the dataset tools; compressed with the
+// EVIMO_COMPRESSED_EVENTS build option
+#ifdef EVIMO_COMPRESSED_EVENTS
+typedef CompressedEventStore EventArray;
+typedef CompressedEventStore EventArrayBuilder;
+#else
+typedef EventStore EventArray;
+typedef EventStoreBuilder EventArrayBuilder;
+#endif
+
+
+#endif // COMPRESSED_EVENT_STORE_H
@@ -1,32 +1,142 @@
 #include <dataset.h>
 
-std::shared_ptr<StaticObject> Dataset::background;
-std::map<int, std::shared_ptr<ViObject>> Dataset::clouds;
-std::vector<Event> Dataset::event_array;
-std::vector<cv::Mat> Dataset::images;
-std::vector<ros::Time> Dataset::image_ts;
-Trajectory Dataset::cam_tj;
-std::map<int, Trajectory> Dataset::obj_tjs;
-
-float Dataset::fx, Dataset::fy, Dataset::cx, Dataset::cy;
-unsigned int Dataset::res_x, Dataset::res_y;
-float Dataset::k1, Dataset::k2, Dataset::k3, Dataset::k4;
-float Dataset::rr0, Dataset::rp0, Dataset::ry0;
-float Dataset::tx0, Dataset::ty0, Dataset::tz0;
-tf::Transform Dataset::bg_E;
-tf::Transform Dataset::cam_E;
-float Dataset::slice_width = 0.04;
-std::map<int, bool> Dataset::enabled_objects;
-std::string Dataset::window_name;
-int Dataset::value_rr = MAXVAL / 2, Dataset::value_rp = MAXVAL / 2, Dataset::value_ry = MAXVAL / 2;
-int Dataset::value_tx = MAXVAL / 2, Dataset::value_ty = MAXVAL / 2, Dataset::value_tz = MAXVAL / 2;
-bool Dataset::modified = true;
-float Dataset::pose_filtering_window = 0.04;
-
-// Time offset controls
-float Dataset::image_to_event_to, Dataset::pose_to_event_to;
-int Dataset::image_to_event_to_slider = MAXVAL / 2, Dataset::pose_to_event_to_slider = MAXVAL / 2;
-
-// Folder names
-std::string Dataset::dataset_folder = "";
-std::string Dataset::gt_folder = "";
+
+bool Dataset::init(std::string dataset_folder) {
+    this->dataset_folder = dataset_folder;
+    bool ret = this->parse_config(this->dataset_folder + "/config.txt");
+    ret &= this->read_cam_intr(this->dataset_folder + "/calib.txt");
+    ret &= this->read_extr(this->dataset_folder + "/extrinsics.txt");
+    return ret;
+}
+
+
+bool Dataset::parse_config(std::string path) {
+    std::ifstream ifs;
+    ifs.open(path, std::ifstream::in);
+    if (!ifs.is_open()) {
+        std::cout << _red("Could not open configuration file at ")
+                  << path << "!" << std::endl;
+        return false;
+    }
+
+    std::cout << _blue("Opening configuration file: ")
+              << path  << std::endl;
+    for (int i = 0; i < 3; ++i) {
+        std::string line;
+        std::getline(ifs, line);
+        if (line.find("true") != std::string::npos) {
+            std::cout << _blue("\tEnabling object ") << i + 1 << std::endl;
+            this->enabled_objects[i + 1] = true;
+        }
+    }
+
+    ifs.close();
+    return true;
+}
+
+
+bool Dataset::read_cam_intr(std::string path) {
+    std::ifstream ifs;
+    ifs.open(path, std::ifstream::in);
+    if (!ifs.is_open()) {
+        std::cout << _red("Could not open camera intrinsic calibration file at ")
+                  << path << "!" << std::endl;
+        return false;
+    }
+
+    ifs >> this->fx >> this->fy >> this->cx >> this->cy;
+    if (!ifs.good()) {
+        std::cout << _red("Camera calibration read error:") << " Expected a file with a single line, containing "
+                  << "fx fy cx cy {k1 k2 k3 k4} ({} are optional)" << std::endl;
+        return false;
+    }
+
+    this->k1 = this->k2 = this->k3 = this->k4 = 0;
+    ifs >> this->k1 >> this->k2 >> this->k3 >> this->k4;
+
+    std::cout << _green("Read camera calibration: (fx fy cx cy {k1 k2 k3 k4}): ")
+              << this->fx << " " << this->fy << " " << this->cx << " " << this->cy << " "
+              << this->k1 << " " << this->k2 << " " << this->k3 << " " << this->k4 << std::endl;
+    ifs.close();
+    this->update_cam_calib();
+    return true;
+}
+
+
+bool Dataset::read_extr(std::string path) {
+    std::ifstream ifs;
+    ifs.open(path, std::ifstream::in);
+    if (!ifs.is_open()) {
+        std::cout << _red("Could not open extrinsic calibration file at ")
+                  << path << "!" << std::endl;
+        return false;
+    }
+
+    ifs >> this->tx0 >> this->ty0 >> this->tz0 >> this->rr0 >> this->rp0 >> this->ry0;
+    if (!ifs.good()) {
+        std::cout << _red("Camera -> Vicon is suppposed to be in <x y z R P Y> format!") << std::endl;
+        return false;
+    }
+
+    float bg_tx, bg_ty, bg_tz, bg_qw, bg_qx, bg_qy, bg_qz;
+    ifs >> bg_tx >> bg_ty >> bg_tz >> bg_qw >> bg_qx >> bg_qy >> bg_qz;
+    if (!ifs.good()) {
+        std::cout << _red("Background -> Vicon is suppposed to be in <x y z Qw Qx Qy Qz> format!") << std::endl;
+        return false;
+    }
+
+    ifs >> this->pose_to_event_to;
+    if (!ifs.good()) {
+        this->pose_to_event_to = 0;
+        std::cout << _yellow("Time offset (pos) is not specified;") << " setting to " << this->pose_to_event_to << std::endl;
+    }
+
+    ifs >> this->image_to_event_to;
+    if (!ifs.good()) {
+        this->image_to_event_to = 0;
+        std::cout << _yellow("Time offset (img) is not specified;") << " setting to " << this->image_to_event_to << std::endl;
+    }
+
+    ifs.close();
+
+    tf::Vector3 T;
+    tf::Quaternion Q(bg_qx, bg_qy, bg_qz, bg_qw);
+    T.setValue(bg_tx, bg_ty, bg_tz);
+
+    this->bg_E.setRotation(Q);
+    this->bg_E.setOrigin(T);
+
+    // Old extrinsic format
+    bool old_ext_format = false;
+    if (old_ext_format) {
+        Eigen::Matrix4f T1;
+        T1 <<  0.0,   -1.0,   0.0,  0.00,
+               1.0,    0.0,   0.0,  0.00,
+               0.0,    0.0,   1.0,  0.00,
+                 0,      0,     0,     1;
+
+        Eigen::Matrix4f T2;
+        T2 <<  0.0,    0.0,  -1.0,  0.00,
+               0.0,    1.0,   0.0,  0.00,
+               1.0,    0.0,   0.0,  0.00,
+                 0,      0,     0,     1;
+
+        tf::Transform E_;
+        tf::Vector3 T_(this->tx0, this->ty0, this->tz0);
+        tf::Quaternion q_;
+        q_.setRPY(this->rr0, this->rp0, this->ry0);
+        E_.setRotation(q_);
+        E_.setOrigin(T_);
+
+        this->cam_E = ViObject::mat2tf(T1) * E_ * ViObject::mat2tf(T2);
+
+        auto pose = Pose(ros::Time(0), this->cam_E);
+        auto T = pose.getT();
+        auto R = pose.getR();
+
+        this->tx0 = T[0]; this->ty0 = T[1]; this->tz0 = T[2];
+        this->rr0 = R[0]; this->rp0 = R[1]; this->ry0 = R[2];
+    }
+
+    return true;
+}
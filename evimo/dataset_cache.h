@@ -0,0 +1,287 @@
+#ifndef DATASET_CACHE_H
+#define DATASET_CACHE_H
+
+#include <map>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <boost/filesystem.hpp>
+
+#include <ros/ros.h>
+#include <ros/serialization.h>
+#include <opencv2/core/core.hpp>
+
+// VICON
+#include <vicon/Subject.h>
+
+#include <common.h>
+#include <event_store.h>
+#include <compressed_event_store.h>
+#include <event_writer.h>
+#include <mapped_file.h>
+#include <trajectory.h>
+
+
+// Contents of a recording as decoded from the bag, before any of the time
+// offsets from the dataset configuration are applied: event timestamps are
+// relative to the first event, pose and image timestamps are header stamps
+class DecodedBag {
+public:
+    EventArray events;
+    ros::Time first_event_message_ts;
+    unsigned int res_x, res_y;
+
+    std::vector<Pose> cam_poses;
+    std::map<int, std::vector<Pose>> obj_poses;
+    std::map<int, vicon::Subject> obj_cloud_to_vicon_tf;
+
+    std::vector<ros::Time> image_ts;
+    std::vector<cv::Mat> images;
+
+    // Memory the images point into when loaded from the cache
+    std::vector<std::shared_ptr<MappedFile>> mappings;
+
+    DecodedBag() : res_x(0), res_y(0) {}
+};
+
+
+// On-disk cache of a DecodedBag; a folder with:
+//   key.txt    - bag file size, mtime and reader parameters; written last
+//   events.bin - events in the EventBinWriter format, memory-mapped on load
+//   poses.bin  - trajectories, object-to-vicon subjects, resolution
+//   images.bin - raw image data, memory-mapped on load
+// Time offsets are not part of the key, so they can be tuned without rebuilding the cache
+class DatasetCache {
+public:
+    static constexpr uint32_t VERSION = 1;
+
+    static std::string make_key(std::string bag_fname, const std::map<std::string, std::string> &params) {
+        struct stat st;
+        if (::stat(bag_fname.c_str(), &st) != 0) return "";
+
+        std::ostringstream key;
+        key << "version: " << VERSION << "\n"
+            << "bag: " << boost::filesystem::absolute(bag_fname).string() << "\n"
+            << "size: " << st.st_size << "\n"
+            << "mtime: " << st.st_mtim.tv_sec << "." << st.st_mtim.tv_nsec << "\n";
+        for (auto &p : params)
+            key << p.first << ": " << p.second << "\n";
+        return key.str();
+    }
+
+    static bool load(std::string folder, std::string key, DecodedBag &bag) {
+        std::ifstream key_file(folder + "/key.txt", std::ifstream::in);
+        if (key == "" || !key_file.is_open()) return false;
+        std::string cached_key((std::istreambuf_iterator<char>(key_file)), std::istreambuf_iterator<char>());
+        if (cached_key != key) {
+            std::cout << _yellow("Dataset cache is out of date: ") << folder << std::endl;
+            return false;
+        }
+
+        std::cout << _blue("Loading decoded bag from cache: ") << folder << std::endl;
+        if (!read_events(folder + "/events.bin", bag) || !read_poses(folder + "/poses.bin", bag) ||
+            !read_images(folder + "/images.bin", bag)) {
+            std::cout << _red("Failed to read the dataset cache, decoding the bag") << std::endl;
+            bag = DecodedBag();
+            return false;
+        }
+        return true;
+    }
+
+    static bool save(std::string folder, std::string key, DecodedBag &bag) {
+        if (key == "") return false;
+
+        boost::system::error_code ec;
+        boost::filesystem::create_directories(folder, ec);
+        boost::filesystem::remove(folder + "/key.txt", ec);
+
+        std::cout << _blue("Saving decoded bag to cache: ") << folder << std::endl;
+        EventBinWriter events(folder + "/events.bin", bag.events.size());
+        if (!events.is_open()) return false;
+        events.append(bag.events);
+        if (!events.close() || !write_poses(folder + "/poses.bin", bag) ||
+            !write_images(folder + "/images.bin", bag)) {
+            std::cout << _red("Failed to write the dataset cache") << std::endl;
+            return false;
+        }
+
+        std::ofstream key_file(folder + "/key.txt", std::ofstream::out | std::ofstream::trunc);
+        key_file << key;
+        key_file.close();
+        return key_file.good();
+    }
+
+protected:
+    template<class T> static void write_pod(std::ofstream &f, const T &v) {
+        f.write(reinterpret_cast<const char*>(&v), sizeof(T));
+    }
+
+    template<class T> static bool read_pod(std::ifstream &f, T &v) {
+        return bool(f.read(reinterpret_cast<char*>(&v), sizeof(T)));
+    }
+
+    static bool read_events(std::string fname, DecodedBag &bag) {
+        EventBinReader reader(fname);
+        return reader.is_open() && read_events(reader, bag.events);
+    }
+
+    // Events are used straight from the mapped file, or compressed from it
+    static bool read_events(const EventBinReader &reader, EventStore &events) {
+        return reader.read(events);
+    }
+
+    static bool read_events(const EventBinReader &reader, CompressedEventStore &events) {
+        EventStore mapped;
+        if (!reader.read(mapped)) return false;
+        events.append(mapped);
+        return true;
+    }
+
+    static void write_pose(std::ofstream &f, const Pose &p) {
+        write_pod(f, p.ts.sec);
+        write_pod(f, p.ts.nsec);
+        auto T = p.pq.getOrigin();
+        auto R = p.pq.getBasis();
+        double v[12] = {T.x(), T.y(), T.z(),
+                        R[0].x(), R[0].y(), R[0].z(),
+                        R[1].x(), R[1].y(), R[1].z(),
+                        R[2].x(), R[2].y(), R[2].z()};
+        write_pod(f, v);
+        write_pod(f, p.occlusion);
+    }
+
+    static bool read_pose(std::ifstream &f, Pose &p) {
+        uint32_t sec = 0, nsec = 0;
+        double v[12];
+        if (!read_pod(f, sec) || !read_pod(f, nsec) || !read_pod(f, v) || !read_pod(f, p.occlusion))
+            return false;
+
+        tf::Matrix3x3 R;
+        R.setValue(v[3], v[4], v[5], v[6], v[7], v[8], v[9], v[10], v[11]);
+        p.ts = ros::Time(sec, nsec);
+        p.pq = tf::Transform(R, tf::Vector3(v[0], v[1], v[2]));
+        return true;
+    }
+
+    // Trajectories are written with id -1 for the camera
+    static bool write_poses(std::string fname, DecodedBag &bag) {
+        std::ofstream f(fname, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+        write_pod(f, bag.first_event_message_ts.sec);
+        write_pod(f, bag.first_event_message_ts.nsec);
+        write_pod(f, bag.res_x);
+        write_pod(f, bag.res_y);
+
+        write_pod(f, uint32_t(bag.obj_poses.size() + 1));
+        auto write_tj = [&f](int32_t id, std::vector<Pose> &poses) {
+            write_pod(f, id);
+            write_pod(f, uint64_t(poses.size()));
+            for (auto &p : poses) write_pose(f, p);
+        };
+
+        write_tj(-1, bag.cam_poses);
+        for (auto &tj : bag.obj_poses)
+            write_tj(tj.first, tj.second);
+
+        write_pod(f, uint32_t(bag.obj_cloud_to_vicon_tf.size()));
+        for (auto &s : bag.obj_cloud_to_vicon_tf) {
+            uint32_t len = ros::serialization::serializationLength(s.second);
+            std::vector<uint8_t> buf(len);
+            ros::serialization::OStream stream(buf.data(), len);
+            ros::serialization::serialize(stream, s.second);
+
+            write_pod(f, int32_t(s.first));
+            write_pod(f, len);
+            f.write(reinterpret_cast<const char*>(buf.data()), len);
+        }
+
+        f.close();
+        return f.good();
+    }
+
+    static bool read_poses(std::string fname, DecodedBag &bag) {
+        std::ifstream f(fname, std::ifstream::in | std::ifstream::binary);
+        uint32_t sec = 0, nsec = 0, n_tjs = 0;
+        if (!read_pod(f, sec) || !read_pod(f, nsec) || !read_pod(f, bag.res_x) ||
+            !read_pod(f, bag.res_y) || !read_pod(f, n_tjs))
+            return false;
+        bag.first_event_message_ts = ros::Time(sec, nsec);
+
+        for (uint32_t i = 0; i < n_tjs; ++i) {
+            int32_t id = 0;
+            uint64_t n = 0;
+            if (!read_pod(f, id) || !read_pod(f, n)) return false;
+
+            auto &poses = (id < 0) ? bag.cam_poses : bag.obj_poses[id];
+            poses.resize(n);
+            for (auto &p : poses)
+                if (!read_pose(f, p)) return false;
+        }
+
+        uint32_t n_subjects = 0;
+        if (!read_pod(f, n_subjects)) return false;
+        for (uint32_t i = 0; i < n_subjects; ++i) {
+            int32_t id = 0;
+            uint32_t len = 0;
+            if (!read_pod(f, id) || !read_pod(f, len)) return false;
+
+            std::vector<uint8_t> buf(len);
+            if (!f.read(reinterpret_cast<char*>(buf.data()), len)) return false;
+            ros::serialization::IStream stream(buf.data(), len);
+            ros::serialization::deserialize(stream, bag.obj_cloud_to_vicon_tf[id]);
+        }
+        return true;
+    }
+
+    // Every image is a 32-byte record followed by its pixels, padded to 8 bytes
+    struct ImageRecord {
+        uint32_t sec, nsec;
+        int32_t rows, cols, type, pad;
+        uint64_t size;
+    };
+
+    static bool write_images(std::string fname, DecodedBag &bag) {
+        std::ofstream f(fname, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+        write_pod(f, uint64_t(bag.images.size()));
+        for (uint64_t i = 0; i < bag.images.size(); ++i) {
+            cv::Mat img = bag.images[i].isContinuous() ? bag.images[i] : bag.images[i].clone();
+            ImageRecord r = {bag.image_ts[i].sec, bag.image_ts[i].nsec, img.rows, img.cols, img.type(), 0,
+                             uint64_t(img.total() * img.elemSize())};
+            write_pod(f, r);
+            f.write(reinterpret_cast<const char*>(img.data), r.size);
+
+            const char zeros[8] = {0};
+            f.write(zeros, (8 - r.size % 8) % 8);
+        }
+
+        f.close();
+        return f.good();
+    }
+
+    static bool read_images(std::string fname, DecodedBag &bag) {
+        auto file = std::make_shared<MappedFile>(fname);
+        if (!file->is_open() || file->size() < sizeof(uint64_t)) return false;
+
+        const uint8_t *p = file->data(), *end = file->data() + file->size();
+        uint64_t n = 0;
+        std::memcpy(&n, p, sizeof(n));
+        p += sizeof(n);
+
+        for (uint64_t i = 0; i < n; ++i) {
+            ImageRecord r;
+            if (p + sizeof(r) > end) return false;
+            std::memcpy(&r, p, sizeof(r));
+            p += sizeof(r);
+            if (p + r.size > end || r.size != uint64_t(r.rows) * r.cols * CV_ELEM_SIZE(r.type)) return false;
+
+            bag.image_ts.push_back(ros::Time(r.sec, r.nsec));
+            bag.images.push_back(cv::Mat(r.rows, r.cols, r.type, const_cast<uint8_t*>(p)));
+            p += (r.size + 7) / 8 * 8;
+        }
+
+        bag.mappings.push_back(file);
+        return true;
+    }
+};
+
+
+#endif // DATASET_CACHE_H
@@ -4,13 +4,13 @@
 
 cv::Mat DatasetFrame::get_visualization_event_projection(bool timg) {
     cv::Mat img;
-    if (Dataset::event_array.size() > 0) {
-        auto ev_slice = Slice<std::vector<Event>>(Dataset::event_array,
-                                                  this->event_slice_ids);
+    if (this->dataset->event_array.size() > 0) {
+        auto ev_slice = Slice<EventArray>(this->dataset->event_array,
+                                           this->event_slice_ids);
         if (timg) {
-            img = EventFile::color_time_img(&ev_slice, 1, Dataset::res_x, Dataset::res_y);
+            img = EventFile::color_time_img(&ev_slice, 1, this->dataset->res_x, this->dataset->res_y);
         } else {
-            img = EventFile::projection_img(&ev_slice, 1, Dataset::res_x, Dataset::res_y);
+            img = EventFile::projection_img(&ev_slice, 1, this->dataset->res_x, this->dataset->res_y);
         }
     }
     return img;
@@ -30,7 +30,7 @@ cv::Mat DatasetFrame::get_visualization_depth(bool overlay_events) {
             ret.at<cv::Vec3b>(i, j)[0] = depth_img.at<float>(i, j);
             ret.at<cv::Vec3b>(i, j)[1] = depth_img.at<float>(i, j);
             ret.at<cv::Vec3b>(i, j)[2] = depth_img.at<float>(i, j);
-            if (overlay_events && Dataset::event_array.size() > 0)
+            if (overlay_events && this->dataset->event_array.size() > 0)
                 ret.at<cv::Vec3b>(i, j)[2] = img_pr.at<uint8_t>(i, j);
         }
     }
@@ -54,7 +54,7 @@ cv::Mat DatasetFrame::get_visualization_mask(bool overlay_events) {
             } else {
                 ret.at<cv::Vec3b>(i, j) = color;
             }
-            if (overlay_events && Dataset::event_array.size() > 0 && img_pr.at<uint8_t>(i, j) > 0)
+            if (overlay_events && this->dataset->event_array.size() > 0 && img_pr.at<uint8_t>(i, j) > 0)
                 ret.at<cv::Vec3b>(i, j)[2] = img_pr.at<uint8_t>(i, j);
         }
     }
@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <thread>
+#include <fstream>
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
@@ -12,16 +13,28 @@
 #include <dataset.h>
 #include <object.h>
 #include <trajectory.h>
+#include <projection.h>
+#include <rasterizer.h>
+#include <depth_warp.h>
+#include <thread_pool.h>
 
 class DatasetFrame {
 protected:
     static std::list<DatasetFrame*> visualization_list;
 
+    // The sequence the frame belongs to
+    std::shared_ptr<Dataset> dataset;
+
     // Baseline timestamp
     double timestamp;
 
-    // Thread handle
-    std::thread thread_handle;
+    // Pending generate_async task
+    std::future<void> task;
+
+    // Per-worker buffers of project_mesh, reused across frames
+    struct MeshScratch {
+        std::vector<float> cam;
+    };
 public:
     uint64_t cam_pose_id;
     std::map<int, uint64_t> obj_pose_ids;
@@ -33,6 +46,7 @@ public:
     cv::Mat mask;
 
     std::string gt_img_name;
+    std::string gt_rect_img_name;
     std::string rgb_img_name;
 
 public:
@@ -49,21 +63,28 @@ public:
             cv::namedWindow(window_names[frame_ptr], cv::WINDOW_NORMAL);
         }
 
-        Dataset::modified = true;
-        Dataset::init_GUI();
+        if (window_names.empty()) return;
+
+        // The frames on screen are expected to come from one dataset
+        auto dataset = DatasetFrame::visualization_list.front()->dataset;
+        dataset->modified = true;
+        dataset->init_GUI();
         const uint8_t nmodes = 3;
         uint8_t vis_mode = 0;
 
         int code = 0; // Key code
         while (code != 27) {
             code = cv::waitKey(1);
-            Dataset::handle_keys(code, vis_mode, nmodes);
+            dataset->handle_keys(code, vis_mode, nmodes);
 
-            if (!Dataset::modified) continue;
-            Dataset::modified = false;
+            if (!dataset->modified) continue;
+            dataset->modified = false;
+            dataset->apply_settings();
 
+            // Frames are rendered concurrently, so the cores are split between them
+            size_t n_threads = std::max(std::thread::hardware_concurrency() / window_names.size(), size_t(1));
             for (auto &window : window_names) {
-                window.first->generate_async();
+                window.first->generate_async(n_threads);
             }
 
             for (auto &window : window_names) {
@@ -90,28 +111,33 @@ public:
     }
 
     // ---------
-    DatasetFrame(uint64_t cam_p_id, double ref_ts, unsigned long int fid)
-        : cam_pose_id(cam_p_id), timestamp(ref_ts), frame_id(fid), event_slice_ids(0, 0),
-          depth(Dataset::res_x, Dataset::res_y, CV_32F, cv::Scalar(0)),
-          mask(Dataset::res_x, Dataset::res_y, CV_8U, cv::Scalar(0)) {
-        this->cam_pose_id = TimeSlice(Dataset::cam_tj).find_nearest(this->get_timestamp(), this->cam_pose_id);
+    DatasetFrame(std::shared_ptr<Dataset> dataset_, uint64_t cam_p_id, double ref_ts, unsigned long int fid)
+        : dataset(dataset_), timestamp(ref_ts), cam_pose_id(cam_p_id), frame_id(fid), event_slice_ids(0, 0),
+          depth(dataset_->res_x, dataset_->res_y, CV_32F, cv::Scalar(0)),
+          mask(dataset_->res_x, dataset_->res_y, CV_8U, cv::Scalar(0)) {
+        this->cam_pose_id = TimeSlice(this->dataset->cam_tj).find_nearest(this->get_timestamp(), this->cam_pose_id);
         this->gt_img_name  = "depth_mask_" + std::to_string(this->frame_id) + ".png";
+        this->gt_rect_img_name = "depth_mask_rect_" + std::to_string(this->frame_id) + ".png";
         this->rgb_img_name = "img_" + std::to_string(this->frame_id) + ".png";
     }
 
     void add_object_pos_id(int id, uint64_t obj_p_id) {
         this->obj_pose_ids.insert(std::make_pair(id, obj_p_id));
-        this->obj_pose_ids[id] = TimeSlice(Dataset::obj_tjs.at(id)).find_nearest(this->get_timestamp(), this->obj_pose_ids[id]);
+        this->obj_pose_ids[id] = TimeSlice(this->dataset->obj_tjs.at(id)).find_nearest(this->get_timestamp(), this->obj_pose_ids[id]);
     }
 
     void add_event_slice_ids(uint64_t event_low, uint64_t event_high) {
         this->event_slice_ids = std::make_pair(event_low, event_high);
-        this->event_slice_ids = TimeSlice(Dataset::event_array,
-            std::make_pair(this->timestamp - Dataset::get_time_offset_event_to_host_correction() - Dataset::slice_width / 2.0,
-                           this->timestamp - Dataset::get_time_offset_event_to_host_correction() + Dataset::slice_width / 2.0),
+        this->event_slice_ids = TimeSlice(this->dataset->event_array,
+            std::make_pair(this->timestamp - this->dataset->get_time_offset_event_to_host_correction() - this->dataset->slice_width / 2.0,
+                           this->timestamp - this->dataset->get_time_offset_event_to_host_correction() + this->dataset->slice_width / 2.0),
             this->event_slice_ids).get_indices();
     }
 
+    std::shared_ptr<Dataset> get_dataset() const {
+        return this->dataset;
+    }
+
     void add_img(cv::Mat &img_) {
         this->img = img_;
     }
@@ -122,13 +148,13 @@ public:
 
     Pose get_true_camera_pose() {
         auto cam_pose = this->_get_raw_camera_pose();
-        auto cam_tf = cam_pose.pq * Dataset::cam_E;
+        auto cam_tf = cam_pose.pq * this->dataset->cam_E;
         return Pose(cam_pose.ts, cam_tf);
     }
 
     Pose get_camera_velocity() {
-        auto vel = Dataset::cam_tj.get_velocity(this->cam_pose_id);
-        vel.pq = Dataset::cam_E.inverse() * vel.pq * Dataset::cam_E;
+        auto vel = this->dataset->cam_tj.get_velocity(this->cam_pose_id);
+        vel.pq = this->dataset->cam_E.inverse() * vel.pq * this->dataset->cam_E;
         return vel;
     }
 
@@ -141,7 +167,7 @@ public:
 
         auto obj_pose = this->_get_raw_object_pose(id);
         auto cam_tf   = this->get_true_camera_pose();
-        auto obj_tf   = Dataset::clouds.at(id)->get_tf_in_camera_frame(
+        auto obj_tf   = this->dataset->clouds.at(id)->get_tf_in_camera_frame(
                                                       cam_tf, obj_pose.pq);
         return Pose(cam_tf.ts, obj_tf);
     }
@@ -149,7 +175,7 @@ public:
 /*
     TODO: Need to define a frame in which to report!
     Pose get_object_velocity(int id) {
-        auto vel = Dataset::obj_tjs.at(id).get_velocity(this->obj_pose_ids.at(id));
+        auto vel = this->dataset->obj_tjs.at(id).get_velocity(this->obj_pose_ids.at(id));
         //auto cam_pose = get_true_camera_pose();
         //cam_pose.setT({0, 0, 0});
         //auto l = get_object_pose_cam_frame(id).pq.inverse() * cam_pose.pq;
@@ -160,42 +186,51 @@ public:
 */
 
     float get_timestamp() {
-        return this->timestamp - Dataset::get_time_offset_pose_to_host_correction();
+        return this->timestamp - this->dataset->get_time_offset_pose_to_host_correction();
     }
 
     std::string get_info() {
         std::string s;
         s += std::to_string(frame_id) + ": " + std::to_string(get_timestamp()) + "\t";
         s += std::to_string(get_true_camera_pose().ts.toSec()) + "\t";
-        for (auto &obj : Dataset::clouds) {
+        for (auto &obj : this->dataset->clouds) {
             s += std::to_string(this->_get_raw_object_pose(obj.first).ts.toSec()) + "\t";
         }
         return s;
     }
 
-    // Generate frame
-    void generate() {
+    // Generate frame; with n_threads != 1 the depth / mask are rasterized
+    // with TiledRasterizer (0 - all cores), for when a single frame is rendered.
+    // With a warper the background is warped from the last keyframe of that
+    // warper (see DepthWarper), so its frames have to be generated in order.
+    // The dataset is only read: see Dataset::apply_settings()
+    void generate(size_t n_threads = 1, DepthWarper *warper = nullptr) {
         this->depth = cv::Scalar(0);
         this->mask  = cv::Scalar(0);
 
-        Dataset::update_cam_calib();
-        Dataset::cam_tj.set_filtering_window_size(Dataset::pose_filtering_window);
-        this->cam_pose_id = TimeSlice(Dataset::cam_tj).find_nearest(this->get_timestamp(), this->cam_pose_id);
-        this->event_slice_ids = TimeSlice(Dataset::event_array,
-            std::make_pair(this->timestamp - Dataset::get_time_offset_event_to_host_correction() - Dataset::slice_width / 2.0,
-                           this->timestamp - Dataset::get_time_offset_event_to_host_correction() + Dataset::slice_width / 2.0),
+        this->cam_pose_id = TimeSlice(this->dataset->cam_tj).find_nearest(this->get_timestamp(), this->cam_pose_id);
+        this->event_slice_ids = TimeSlice(this->dataset->event_array,
+            std::make_pair(this->timestamp - this->dataset->get_time_offset_event_to_host_correction() - this->dataset->slice_width / 2.0,
+                           this->timestamp - this->dataset->get_time_offset_event_to_host_correction() + this->dataset->slice_width / 2.0),
             this->event_slice_ids).get_indices();
 
+        std::shared_ptr<TiledRasterizer> raster;
+        if (n_threads != 1) raster = std::make_shared<TiledRasterizer>();
+
         auto cam_tf = this->get_true_camera_pose();
-        if (Dataset::background != nullptr) {
-            auto cl = Dataset::background->transform_to_camframe(cam_tf);
-            this->project_cloud(cl, 0);
+        if (this->dataset->background != nullptr) {
+            auto &bg = this->dataset->background;
+            if (warper != nullptr && !(this->dataset->mesh && !bg->get_triangles().empty()))
+                this->project_background_incremental(*warper, this->dataset->background_matrix(cam_tf), raster.get(), n_threads);
+            else if (this->dataset->mesh && !bg->get_triangles().empty())
+                this->project_mesh(bg->get_mesh_vertices(), bg->get_triangles(), this->dataset->background_matrix(cam_tf), 0);
+            else
+                this->project_cloud(bg->get_model(), bg->get_bvh(), this->dataset->background_matrix(cam_tf), 0, raster.get());
         }
 
-        for (auto &obj : Dataset::clouds) {
+        for (auto &obj : this->dataset->clouds) {
             auto id = obj.first;
-            Dataset::obj_tjs.at(id).set_filtering_window_size(Dataset::pose_filtering_window);
-            this->obj_pose_ids[id] = TimeSlice(Dataset::obj_tjs.at(id)).find_nearest(this->get_timestamp(), this->obj_pose_ids[id]);
+            this->obj_pose_ids[id] = TimeSlice(this->dataset->obj_tjs.at(id)).find_nearest(this->get_timestamp(), this->obj_pose_ids[id]);
 
             if (this->obj_pose_ids.find(id) == this->obj_pose_ids.end()) {
                 std::cout << _yellow("Warning! ") << "No pose for object "
@@ -204,17 +239,25 @@ public:
             }
 
             auto obj_pose = this->_get_raw_object_pose(id);
-            auto cl = obj.second->transform_to_camframe(cam_tf, obj_pose.pq);
-            this->project_cloud(cl, id);
+            if (this->dataset->mesh && !obj.second->get_triangles().empty())
+                this->project_mesh(obj.second->get_mesh_vertices(), obj.second->get_triangles(),
+                                   this->dataset->object_matrix(id, cam_tf, obj_pose.pq), id);
+            else
+                this->project_cloud(obj.second->get_model(), obj.second->get_bvh(),
+                                    this->dataset->object_matrix(id, cam_tf, obj_pose.pq), id, raster.get());
         }
+
+        if (raster) raster->resolve(this->depth, this->mask, n_threads);
     }
 
-    void generate_async() {
-        this->thread_handle = std::thread(&DatasetFrame::generate, this);
+    // Queue generate() on the shared thread pool; join() waits for it and
+    // rethrows what it threw
+    void generate_async(size_t n_threads = 1) {
+        this->task = ThreadPool::shared().submit([this, n_threads]() {this->generate(n_threads); });
     }
 
     void join() {
-        this->thread_handle.join();
+        if (this->task.valid()) this->task.get();
     }
 
     // Visualization helpers
@@ -231,9 +274,9 @@ public:
         ret += "\t'vel': " + this->get_camera_velocity().as_dict() + ",\n";
 
         // Represent camera poses in the frame of the initial camera pose (p0)
-        auto p0 = Dataset::cam_tj[0];
+        auto p0 = this->dataset->cam_tj[0];
         auto cam_pose = this->_get_raw_camera_pose();
-        auto cam_tf = Dataset::cam_E.inverse() * (cam_pose - p0).pq * Dataset::cam_E;
+        auto cam_tf = this->dataset->cam_E.inverse() * (cam_pose - p0).pq * this->dataset->cam_E;
         ret += "\t'pos': " + Pose(cam_pose.ts, cam_tf).as_dict() + ",\n";
         ret += "\t'ts': " + std::to_string(this->get_true_camera_pose().ts.toSec()) + "},\n";
 
@@ -247,6 +290,9 @@ public:
 
         // image paths
         ret += "'gt_frame': '" + this->gt_img_name + "'";
+        if (this->dataset->rectify) {
+            ret += ",\n'gt_frame_rect': '" + this->gt_rect_img_name + "'";
+        }
         if (this->img.rows == this->mask.rows && this->img.cols == this->mask.cols) {
             ret += ",\n'classical_frame': '" + this->rgb_img_name + "'";
         }
@@ -255,102 +301,310 @@ public:
         return ret;
     }
 
+    // (file name, PNG data) of the ground truth images of the frame
+    typedef std::vector<std::pair<std::string, std::vector<uchar>>> EncodedImages;
+
     void save_gt_images() {
-        cv::Mat _depth, _mask;
-        this->depth.convertTo(_depth, CV_16UC1, 1000);
-        this->mask.convertTo(_mask, CV_16UC1, 1000);
-        std::vector<cv::Mat> ch = {_depth, _depth, _mask};
-        cv::Mat gt_frame_i16(this->mask.rows, this->mask.cols, CV_16UC3, cv::Scalar(0, 0, 0));
-        cv::merge(ch, gt_frame_i16);
+        DatasetFrame::write_images(this->dataset->gt_folder, this->encode_gt_images());
+    }
 
-        gt_frame_i16.convertTo(gt_frame_i16, CV_16UC3);
-        cv::imwrite(Dataset::gt_folder + "/" + this->gt_img_name, gt_frame_i16);
+    // The compression part of save_gt_images(), which touches no files
+    EncodedImages encode_gt_images() {
+        EncodedImages ret;
+        auto params = this->dataset->png_params();
+        auto encode = [&ret, &params](const std::string &name, const cv::Mat &img) {
+            ret.emplace_back(name, std::vector<uchar>());
+            cv::imencode(name.substr(name.rfind('.')), img, ret.back().second, params);
+        };
+
+        encode(this->gt_img_name, DatasetFrame::gt_frame(this->depth, this->mask));
+
+        auto rect = this->dataset->get_rectification();
+        if (rect != nullptr) {
+            encode(this->gt_rect_img_name, DatasetFrame::gt_frame(rect->remap(this->depth), rect->remap(this->mask)));
+        }
 
         if (this->img.rows == this->mask.rows && this->img.cols == this->mask.cols) {
-            cv::imwrite(Dataset::gt_folder + "/" + this->rgb_img_name, this->img);
+            encode(this->rgb_img_name, this->img);
         }
+        return ret;
     }
 
-public:
-    template<class T> static void project_point(T p, int &u, int &v) {
-        u = -1; v = -1;
-        if (p.z < 0.00001)
-            return;
+    static void write_images(const std::string &folder, const EncodedImages &images) {
+        for (auto &image : images) {
+            std::string fname = folder + "/" + image.first;
+            std::ofstream file(fname, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+            if (!file.is_open()) {
+                std::cout << _red("Could not open ") << fname << _red(" for writing!") << std::endl;
+                continue;
+            }
+            file.write(reinterpret_cast<const char*>(image.second.data()), image.second.size());
+        }
+    }
+
+    // depth (mm) / depth / mask * 1000, as a 16-bit 3-channel image
+    static cv::Mat gt_frame(const cv::Mat &depth, const cv::Mat &mask) {
+        cv::Mat _depth, _mask;
+        depth.convertTo(_depth, CV_16UC1, 1000);
+        mask.convertTo(_mask, CV_16UC1, 1000);
+        std::vector<cv::Mat> ch = {_depth, _depth, _mask};
+        cv::Mat gt_frame_i16(mask.rows, mask.cols, CV_16UC3, cv::Scalar(0, 0, 0));
+        cv::merge(ch, gt_frame_i16);
 
-        float x_ = p.x / p.z;
-        float y_ = p.y / p.z;
+        gt_frame_i16.convertTo(gt_frame_i16, CV_16UC3);
+        return gt_frame_i16;
+    }
 
-        float r2 = x_ * x_ + y_ * y_;
-        float r4 = r2 * r2;
-        float r6 = r2 * r2 * r2;
-        float dist = (1.0 + Dataset::k1 * r2 + Dataset::k2 * r4 +
-                            Dataset::k3 * r6) / (1 + Dataset::k4 * r2);
-        float x__ = x_ * dist;
-        float y__ = y_ * dist;
+public:
+    Projector get_projector() const {
+        return this->dataset->get_projector();
+    }
 
-        u = Dataset::fx * x__ + Dataset::cx;
-        v = Dataset::fy * y__ + Dataset::cy;
+    template<class T> void project_point(T p, int &u, int &v) const {
+        this->get_projector().project(p.x, p.y, p.z, u, v);
     }
 
-    template<class T> static void unproject_point(T &p, float u, float v) {
+    template<class T> void unproject_point(T &p, float u, float v) const {
         // Ignores the spherical distortion!
-        p.x = (u - Dataset::cx) / Dataset::fx;
-        p.y = (v - Dataset::cy) / Dataset::fy;
+        p.x = (u - this->dataset->cx) / this->dataset->fx;
+        p.y = (v - this->dataset->cy) / this->dataset->fy;
         p.z = 1.0;
     }
 
 protected:
-    template<class T> void project_cloud(T cl, int oid) {
-        if (cl->size() == 0)
+    // Model points are transformed to the camera frame and projected in one pass,
+    // in batches, skipping the bvh nodes outside of the view; the splats are drawn
+    // right away, or recorded in 'raster' if it is given
+    void project_cloud(const PointBuffer &model, const PointBVH &bvh, const Eigen::Matrix4f &model_to_cam,
+                       int oid, TiledRasterizer *raster = nullptr, const float *view = nullptr) {
+        if (model.size() == 0)
             return;
 
-        for (auto &p: *cl) {
-            p.z = -p.z;
+        // The camera looks along -z, so the z row is negated
+        float m[12];
+        for (int r = 0; r < 3; ++r)
+            for (int c = 0; c < 4; ++c)
+                m[4 * r + c] = (r == 2) ? -model_to_cam(r, c) : model_to_cam(r, c);
+
+        static constexpr size_t BATCH = 1024;
+        int us[BATCH], vs[BATCH];
+        float z[BATCH];
+
+        auto cols = this->depth.cols;
+        auto rows = this->depth.rows;
+        auto projector = this->get_projector();
+
+        // Points closer than 0.001 are not drawn, the culling planes leave a margin for rounding;
+        // 'view' narrows them down to a part of the image, see PointBVH::visible
+        float r_cull = projector.cull_radius(rows, cols);
+        float full_view[4] = {-r_cull, r_cull, -r_cull, r_cull};
+        if (view == nullptr) view = full_view;
+
+        // Level of detail: about one point per pixel
+        float focal = this->dataset->lod ? std::max(std::fabs(this->dataset->fx), std::fabs(this->dataset->fy)) : 0;
+        bvh.visible(m, 0.0005, view, [&](size_t range_first, size_t range_size) {
+            size_t range_last = range_first + range_size;
+            for (size_t first = range_first; first < range_last; first += BATCH) {
+                size_t n = std::min(BATCH, range_last - first);
+                projector.transform_project(model.x() + first, model.y() + first, model.z() + first, n, m, us, vs, z);
+
+                for (size_t i = 0; i < n; ++i) {
+                    float rng = z[i];
+                    if (rng < 0.001)
+                        continue;
+
+                    int u = us[i], v = vs[i];
+                    if (u < 0 || v < 0 || v >= cols || u >= rows)
+                        continue;
+
+                    int patch_size = 1;//int(1.0 / rng);
+
+                    if (oid == 0)
+                        patch_size = int(5.0 / rng);
+
+                    int u_lo = std::max(u - patch_size / 2, 0);
+                    int u_hi = std::min(u + patch_size / 2, rows - 1);
+                    int v_lo = std::max(v - patch_size / 2, 0);
+                    int v_hi = std::min(v + patch_size / 2, cols - 1);
+
+                    // The image is flipped in both directions
+                    if (raster != nullptr)
+                        raster->add(rows - u_hi - 1, rows - u_lo - 1, cols - v_hi - 1, cols - v_lo - 1, rng, oid);
+                    else
+                        TiledRasterizer::draw(this->depth, this->mask, rows - u_hi - 1, rows - u_lo - 1,
+                                              cols - v_hi - 1, cols - v_lo - 1, rng, oid);
+                }
+            }
+        }, focal);
+    }
 
-            float rng = p.z;
-            if (rng < 0.001)
-                continue;
+    // The background cloud, warped from the keyframe where possible; only the
+    // parts the warp leaves holes in are rendered, with the bvh culled to them.
+    // Where both are set the nearer depth is kept. A full render becomes the
+    // next keyframe
+    void project_background_incremental(DepthWarper &warper, const Eigen::Matrix4f &bg_to_cam,
+                                        TiledRasterizer *raster, size_t n_threads) {
+        // Background splats reach 5 / rng pixels; points slightly outside of a hole still matter
+        static constexpr int MARGIN = 8;
+
+        auto &bg = this->dataset->background;
+        auto projector = this->get_projector();
+        cv::Mat warped(this->depth.rows, this->depth.cols, CV_32F, cv::Scalar(0));
+        std::vector<cv::Rect> holes;
+        bool key = !warper.warp(projector, bg_to_cam, warped) || !DepthWarper::hole_rects(warped, MARGIN, holes);
+
+        if (key) {
+            this->project_cloud(bg->get_model(), bg->get_bvh(), bg_to_cam, 0, raster);
+        } else {
+            for (auto &rect : holes) {
+                float view[4];
+                DepthWarper::view_bounds(projector, this->depth.rows, this->depth.cols, rect, MARGIN, view);
+                this->project_cloud(bg->get_model(), bg->get_bvh(), bg_to_cam, 0, raster, view);
+            }
+        }
 
-            auto cols = this->depth.cols;
-            auto rows = this->depth.rows;
+        if (raster) {
+            raster->resolve(this->depth, this->mask, n_threads);
+            raster->clear();
+        }
 
-            int u = -1, v = -1;
-            this->project_point(p, u, v);
+        if (!key) {
+            for (int r = 0; r < this->depth.rows; ++r) {
+                const float *w = warped.ptr<float>(r);
+                float *d = this->depth.ptr<float>(r);
+                for (int c = 0; c < this->depth.cols; ++c)
+                    if (w[c] >= 0.001 && (d[c] < 0.001 || w[c] < d[c])) d[c] = w[c];
+            }
+        }
 
-            if (u < 0 || v < 0 || v >= cols || u >= rows)
-                continue;
+        if (key) warper.store(projector, bg_to_cam, this->depth);
+    }
 
-            int patch_size = 1;//int(1.0 / rng);
+    // Triangles are clipped against the near plane and subdivided in the camera
+    // frame until their projected edges are short, so that the radial distortion
+    // is followed; every vertex is projected with the same model as project_point.
+    // The triangles are drawn right away, the z-test does not depend on the order
+    void project_mesh(const PointBuffer &vertices, const std::vector<uint32_t> &triangles,
+                      const Eigen::Matrix4f &model_to_cam, int oid) {
+        static constexpr float Z_NEAR = 0.001;
+        static constexpr float MAX_EDGE = 8.0; // pixels
+        static constexpr int MAX_LEVEL = 6;
+
+        auto cols = this->depth.cols;
+        auto rows = this->depth.rows;
+        auto projector = this->get_projector();
+        float r_cull = projector.cull_radius(rows, cols);
+
+        // The camera looks along -z
+        auto &cam = ThreadPool::local<MeshScratch>().cam;
+        cam.resize(vertices.size() * 3);
+        for (size_t i = 0; i < vertices.size(); ++i) {
+            float x = vertices.x()[i], y = vertices.y()[i], z = vertices.z()[i];
+            for (int r = 0; r < 3; ++r) {
+                float c = model_to_cam(r, 0) * x + model_to_cam(r, 1) * y + model_to_cam(r, 2) * z + model_to_cam(r, 3);
+                cam[3 * i + r] = (r == 2) ? -c : c;
+            }
+        }
 
-            if (oid == 0)
-                patch_size = int(5.0 / rng);
+        struct Tri {
+            float p[3][3];
+            int level;
+        };
+
+        // Outside of one of the culling planes, see PointBVH::visible
+        auto outside = [r_cull](const Tri &t) {
+            bool px = true, nx = true, py = true, ny = true;
+            for (auto &p : t.p) {
+                px = px && (p[0] >  r_cull * p[2]);
+                nx = nx && (p[0] < -r_cull * p[2]);
+                py = py && (p[1] >  r_cull * p[2]);
+                ny = ny && (p[1] < -r_cull * p[2]);
+            }
+            return !std::isinf(r_cull) && (px || nx || py || ny);
+        };
+
+        std::vector<Tri> stack;
+        auto push_clipped = [&](const float *a, const float *b, const float *c) {
+            // Sutherland-Hodgman against z >= Z_NEAR; at most 4 vertices remain
+            const float *in[3] = {a, b, c};
+            float poly[4][3];
+            int n = 0;
+            for (int k = 0; k < 3; ++k) {
+                const float *p = in[k], *q = in[(k + 1) % 3];
+                bool p_in = p[2] >= Z_NEAR, q_in = q[2] >= Z_NEAR;
+                if (p_in) {
+                    std::copy(p, p + 3, poly[n++]);
+                }
+                if (p_in != q_in) {
+                    float t = (Z_NEAR - p[2]) / (q[2] - p[2]);
+                    for (int j = 0; j < 3; ++j) poly[n][j] = p[j] + t * (q[j] - p[j]);
+                    poly[n++][2] = Z_NEAR;
+                }
+            }
+
+            for (int k = 2; k < n; ++k) {
+                Tri t;
+                std::copy(poly[0], poly[0] + 3, t.p[0]);
+                std::copy(poly[k - 1], poly[k - 1] + 3, t.p[1]);
+                std::copy(poly[k], poly[k] + 3, t.p[2]);
+                t.level = 0;
+                if (!outside(t)) stack.push_back(t);
+            }
+        };
+
+        for (size_t i = 0; i + 2 < triangles.size(); i += 3) {
+            push_clipped(&cam[3 * triangles[i]], &cam[3 * triangles[i + 1]], &cam[3 * triangles[i + 2]]);
+
+            while (!stack.empty()) {
+                Tri t = stack.back();
+                stack.pop_back();
+
+                // {row, col, depth}, the image is flipped in both directions
+                float s[3][3];
+                for (int k = 0; k < 3; ++k) {
+                    float u, v;
+                    projector.project_subpixel(t.p[k][0], t.p[k][1], t.p[k][2], u, v);
+                    s[k][0] = rows - u;
+                    s[k][1] = cols - v;
+                    s[k][2] = t.p[k][2];
+                }
+
+                float edge = 0;
+                for (int k = 0; k < 3; ++k)
+                    edge = std::max(edge, std::hypot(s[k][0] - s[(k + 1) % 3][0], s[k][1] - s[(k + 1) % 3][1]));
 
-            int u_lo = std::max(u - patch_size / 2, 0);
-            int u_hi = std::min(u + patch_size / 2, rows - 1);
-            int v_lo = std::max(v - patch_size / 2, 0);
-            int v_hi = std::min(v + patch_size / 2, cols - 1);
+                if (edge <= MAX_EDGE || t.level >= MAX_LEVEL) {
+                    TiledRasterizer::draw_triangle(this->depth, this->mask, s[0], s[1], s[2], oid);
+                    continue;
+                }
 
-            for (int ii = u_lo; ii <= u_hi; ++ii) {
-                for (int jj = v_lo; jj <= v_hi; ++jj) {
-                    float base_rng = this->depth.at<float>(rows - ii - 1, cols - jj - 1);
-                    if (base_rng > rng || base_rng < 0.001) {
-                        this->depth.at<float>(rows - ii - 1, cols - jj - 1) = rng;
-                        this->mask.at<uint8_t>(rows - ii - 1, cols - jj - 1) = oid;
-                    }
+                // Split in 4 at the edge midpoints
+                float m[3][3];
+                for (int k = 0; k < 3; ++k)
+                    for (int j = 0; j < 3; ++j)
+                        m[k][j] = (t.p[k][j] + t.p[(k + 1) % 3][j]) / 2;
+
+                const float *sub[4][3] = {{t.p[0], m[0], m[2]}, {m[0], t.p[1], m[1]},
+                                          {m[2], m[1], t.p[2]}, {m[0], m[1], m[2]}};
+                for (auto &st : sub) {
+                    Tri c;
+                    for (int k = 0; k < 3; ++k) std::copy(st[k], st[k] + 3, c.p[k]);
+                    c.level = t.level + 1;
+                    if (!outside(c)) stack.push_back(c);
                 }
             }
         }
     }
 
     Pose _get_raw_camera_pose() {
-        if (this->cam_pose_id >= Dataset::cam_tj.size()) {
+        if (this->cam_pose_id >= this->dataset->cam_tj.size()) {
             std::cout << _yellow("Warning! ") << "Camera pose out of bounds for "
                       << " frame id " << this->frame_id << " with "
-                      << Dataset::cam_tj.size() << " trajectory records and "
+                      << this->dataset->cam_tj.size() << " trajectory records and "
                       << "trajectory id = " << this->cam_pose_id << std::endl;
-            return Dataset::cam_tj[Dataset::cam_tj.size() - 1];
+            return this->dataset->cam_tj[this->dataset->cam_tj.size() - 1];
         }
-        return Dataset::cam_tj[this->cam_pose_id];
+        return this->dataset->cam_tj[this->cam_pose_id];
     }
 
     Pose _get_raw_object_pose(int id) {
@@ -359,15 +613,15 @@ protected:
                       << id << ", frame id = " << this->frame_id << std::endl;
         }
         auto obj_pose_id = this->obj_pose_ids.at(id);
-        auto obj_tj_size = Dataset::obj_tjs.at(id).size();
+        auto obj_tj_size = this->dataset->obj_tjs.at(id).size();
         if (obj_pose_id >= obj_tj_size) {
             std::cout << _yellow("Warning! ") << "Object (" << id << ") pose "
                       << "out of bounds for frame id " << this->frame_id << " with "
                       << obj_tj_size << " trajectory records and "
                       << "trajectory id = " << obj_pose_id << std::endl;
-            return Dataset::obj_tjs.at(id)[obj_tj_size - 1];
+            return this->dataset->obj_tjs.at(id)[obj_tj_size - 1];
         }
-        return Dataset::obj_tjs.at(id)[obj_pose_id];
+        return this->dataset->obj_tjs.at(id)[obj_pose_id];
     }
 };
 
@@ -0,0 +1,203 @@
+#ifndef DEPTH_WARP_H
+#define DEPTH_WARP_H
+
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <algorithm>
+
+#include <Eigen/Dense>
+#include <opencv2/core/core.hpp>
+
+#include <projection.h>
+
+
+// Incremental background rendering: the background depth of the last fully
+// rendered frame (the keyframe) is forward-warped to the new camera pose, and
+// only the pixels the warp leaves empty (disocclusions, the image border) have
+// to be rendered. Every frame is warped from the keyframe itself, not from the
+// previous warped frame, so the rounding error of a warp does not pile up.
+// A full render is requested for the first frame, after a calibration change,
+// or when too much of the frame is missing.
+//
+// One warper serves a chain of frames rendered in order on one thread; the
+// matrices are the raw background model to camera matrices (the camera looks along -z)
+class DepthWarper {
+public:
+    static constexpr int TILE = 64;
+    static constexpr float MAX_HOLE_AREA = 0.5; // of the image
+
+protected:
+    Projector projector;
+    int rows, cols;
+
+    // Normalized ray of every pixel center; NaN where the distortion
+    // model can not be inverted
+    std::vector<float> ray_x, ray_y;
+
+    cv::Mat key_depth;
+    Eigen::Matrix4f key_m;
+
+public:
+    DepthWarper ()
+        : projector(0, 0, 0, 0, 0, 0, 0, 0), rows(0), cols(0) {}
+
+    // Forward-warp the keyframe depth to 'm'; false if a full render is due
+    bool warp (const Projector &p, const Eigen::Matrix4f &m, cv::Mat &depth) {
+        if (this->key_depth.empty() || !(p == this->projector) || depth.rows != this->rows || depth.cols != this->cols)
+            return false;
+
+        // Keyframe camera frame to the current one, with z negated on both sides
+        Eigen::Matrix4f neg = Eigen::Matrix4f::Identity();
+        neg(2, 2) = -1;
+        Eigen::Matrix4f rel = neg * m * this->key_m.inverse() * neg;
+        float rm[12];
+        for (int r = 0; r < 3; ++r)
+            for (int c = 0; c < 4; ++c)
+                rm[4 * r + c] = rel(r, c);
+
+        depth = cv::Scalar(0);
+        for (int r = 0; r < this->rows; ++r) {
+            const float *src = this->key_depth.ptr<float>(r);
+            for (int c = 0; c < this->cols; ++c) {
+                float d = src[c];
+                float x = this->ray_x[size_t(r) * this->cols + c], y = this->ray_y[size_t(r) * this->cols + c];
+                if (d < 0.001 || std::isnan(x))
+                    continue;
+
+                int u, v;
+                float rng;
+                p.transform_project(x * d, y * d, d, rm, u, v, rng);
+                if (rng < 0.001 || u < 0 || v < 0 || u >= this->rows || v >= this->cols)
+                    continue;
+
+                // The image is flipped in both directions
+                float &dst = depth.ptr<float>(this->rows - u - 1)[this->cols - v - 1];
+                if (dst > rng || dst < 0.001) dst = rng;
+            }
+        }
+
+        DepthWarper::fill_cracks(depth);
+        return true;
+    }
+
+    // Make the fully rendered background depth of a frame the new keyframe
+    void store (const Projector &p, const Eigen::Matrix4f &m, const cv::Mat &depth) {
+        if (!(p == this->projector) || depth.rows != this->rows || depth.cols != this->cols)
+            this->build_rays(p, depth.rows, depth.cols);
+
+        // Isolated empty pixels of a rendered frame would come back as
+        // holes in every tile after the warp
+        depth.copyTo(this->key_depth);
+        DepthWarper::fill_cracks(this->key_depth);
+        this->key_m = m;
+    }
+
+    // Bounding boxes of the empty pixels of the warped depth, one per tile with
+    // holes; false if, grown by 'margin', they cover too much of the image for
+    // the partial render to be worth it
+    static bool hole_rects (const cv::Mat &depth, int margin, std::vector<cv::Rect> &rects) {
+        rects.clear();
+        size_t area = 0;
+        for (int r0 = 0; r0 < depth.rows; r0 += TILE) {
+            for (int c0 = 0; c0 < depth.cols; c0 += TILE) {
+                int r1 = std::min(r0 + TILE, depth.rows), c1 = std::min(c0 + TILE, depth.cols);
+                int r_lo = r1, r_hi = r0 - 1, c_lo = c1, c_hi = c0 - 1;
+                for (int r = r0; r < r1; ++r) {
+                    const float *d = depth.ptr<float>(r);
+                    for (int c = c0; c < c1; ++c) {
+                        if (d[c] >= 0.001) continue;
+                        r_lo = std::min(r_lo, r); r_hi = std::max(r_hi, r);
+                        c_lo = std::min(c_lo, c); c_hi = std::max(c_hi, c);
+                    }
+                }
+                if (r_hi < r_lo) continue;
+
+                rects.push_back(cv::Rect(c_lo, r_lo, c_hi - c_lo + 1, r_hi - r_lo + 1));
+                area += size_t(c_hi - c_lo + 1 + 2 * margin) * (r_hi - r_lo + 1 + 2 * margin);
+            }
+        }
+        return area <= MAX_HOLE_AREA * depth.rows * depth.cols;
+    }
+
+    // Normalized view bounds {x_lo, x_hi, y_lo, y_hi} (see PointBVH::visible) of
+    // an image rectangle grown by 'margin' pixels; the border of the rectangle is
+    // unprojected. Infinite bounds if some of it can not be
+    static void view_bounds (const Projector &p, int rows, int cols, cv::Rect rect, int margin, float *view) {
+        const float inf = std::numeric_limits<float>::infinity();
+        view[0] = view[2] = inf;
+        view[1] = view[3] = -inf;
+
+        // Image (row, col) to the projection (u, v), flipped
+        float u_lo = rows - (rect.y + rect.height) - margin, u_hi = rows - rect.y + margin;
+        float v_lo = cols - (rect.x + rect.width) - margin, v_hi = cols - rect.x + margin;
+        int n_u = int(u_hi - u_lo), n_v = int(v_hi - v_lo);
+        for (int i = 0; i <= 2 * (n_u + n_v); ++i) {
+            float u, v;
+            if (i <= n_u) {
+                u = u_lo + i; v = v_lo;
+            } else if (i <= 2 * n_u) {
+                u = u_lo + (i - n_u); v = v_hi;
+            } else if (i <= 2 * n_u + n_v) {
+                u = u_lo; v = v_lo + (i - 2 * n_u);
+            } else {
+                u = u_hi; v = v_lo + (i - 2 * n_u - n_v);
+            }
+
+            float x, y;
+            if (!p.unproject(u, v, x, y)) {
+                view[0] = view[2] = -inf;
+                view[1] = view[3] = inf;
+                return;
+            }
+            view[0] = std::min(view[0], x);
+            view[1] = std::max(view[1], x);
+            view[2] = std::min(view[2], y);
+            view[3] = std::max(view[3], y);
+        }
+    }
+
+protected:
+    void build_rays (const Projector &p, int rows_, int cols_) {
+        this->projector = p;
+        this->rows = rows_;
+        this->cols = cols_;
+        this->ray_x.assign(size_t(rows) * cols, std::numeric_limits<float>::quiet_NaN());
+        this->ray_y.assign(size_t(rows) * cols, std::numeric_limits<float>::quiet_NaN());
+        for (int r = 0; r < rows; ++r) {
+            for (int c = 0; c < cols; ++c) {
+                float x, y;
+                if (!p.unproject(rows - r - 0.5f, cols - c - 0.5f, x, y))
+                    continue;
+                this->ray_x[size_t(r) * cols + c] = x;
+                this->ray_y[size_t(r) * cols + c] = y;
+            }
+        }
+    }
+
+    // One-pixel cracks of a magnified surface: an empty pixel between two
+    // valid neighbours (in a row or a column) of about the same depth gets
+    // their average; gaps at depth discontinuities are left to be rendered
+    static void fill_cracks (cv::Mat &depth) {
+        cv::Mat src = depth.clone();
+        for (int r = 1; r + 1 < depth.rows; ++r) {
+            const float *up = src.ptr<float>(r - 1), *mid = src.ptr<float>(r), *down = src.ptr<float>(r + 1);
+            float *d = depth.ptr<float>(r);
+            for (int c = 1; c + 1 < depth.cols; ++c) {
+                if (mid[c] >= 0.001)
+                    continue;
+
+                float pairs[2][2] = {{mid[c - 1], mid[c + 1]}, {up[c], down[c]}};
+                for (auto &pr : pairs) {
+                    if (pr[0] < 0.001 || pr[1] < 0.001 || std::fabs(pr[0] - pr[1]) > 0.05 * std::min(pr[0], pr[1]))
+                        continue;
+                    d[c] = (pr[0] + pr[1]) / 2;
+                    break;
+                }
+            }
+        }
+    }
+};
+
+
+#endif // DEPTH_WARP_H
@@ -0,0 +1,149 @@
+#ifndef EVENT_ARENA_H
+#define EVENT_ARENA_H
+
+#include <cstdio>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include <common.h>
+#include <event_store.h>
+
+
+// Append-only event storage for long recording sessions: events go to large
+// preallocated blocks, so there is no allocation per event. Once the sealed
+// blocks take more than 'memory_cap' bytes, new sealed blocks are moved to an
+// anonymous temporary file and are read back one at a time by for_each_block()
+class EventArena {
+protected:
+    struct Block {
+        EventStore events;
+        bool spilled;
+        long offset;
+        size_t count;
+    };
+
+    std::vector<Block> blocks; // the last block is the active one, it is never spilled
+    size_t block_size, memory_cap, resident, total;
+    std::FILE *spill_file;
+
+public:
+    // block_size is rounded up to a multiple of 64; a memory_cap of 0 disables spilling
+    EventArena (size_t block_size_ = 1 << 20, size_t memory_cap_ = 0)
+        : block_size((std::max(block_size_, size_t(1)) + 63) / 64 * 64), memory_cap(memory_cap_),
+          resident(0), total(0), spill_file(nullptr) {}
+
+    ~EventArena () {
+        if (this->spill_file != nullptr) std::fclose(this->spill_file);
+    }
+
+    EventArena (const EventArena&) = delete;
+    EventArena& operator = (const EventArena&) = delete;
+
+    void set_memory_cap (size_t cap) {this->memory_cap = cap; }
+
+    inline size_t size () const {return this->total; }
+    inline bool empty () const {return this->total == 0; }
+
+    // Bytes of events kept in memory, including the active block
+    size_t memory_usage () const {
+        return this->resident + (this->blocks.empty() ? 0 : this->blocks.back().events.memory_usage());
+    }
+
+    inline void push_back (uint x, uint y, ull t, char pol) {
+        if (this->blocks.empty() || this->blocks.back().events.size() >= this->block_size) this->grow();
+        this->blocks.back().events.push_back(x, y, t, pol);
+        this->total ++;
+    }
+
+    inline void push_back (const Event &e) {
+        this->push_back(e.fr_x, e.fr_y, e.timestamp, e.polarity);
+    }
+
+    // The most recent event; the active block is always in memory
+    EventStore::EventView back () const {
+        if (this->blocks.empty() || this->blocks.back().events.empty()) return EventStore::EventView();
+        auto &events = this->blocks.back().events;
+        return events[events.size() - 1];
+    }
+
+    // Call f(EventStore&) for every block, in order; spilled blocks are loaded
+    // for the duration of the call only
+    template<class F> bool for_each_block (F f) {
+        for (auto &b : this->blocks) {
+            if (!b.spilled) {
+                f(b.events);
+                continue;
+            }
+
+            EventStore events;
+            if (!this->load(b, events)) return false;
+            f(events);
+        }
+        return true;
+    }
+
+protected:
+    void grow () {
+        if (!this->blocks.empty()) this->seal(this->blocks.back());
+        this->blocks.emplace_back();
+        this->blocks.back().spilled = false;
+        this->blocks.back().events.reserve(this->block_size);
+    }
+
+    void seal (Block &b) {
+        b.count = b.events.size();
+        if (this->memory_cap == 0 || this->resident + b.events.memory_usage() <= this->memory_cap || !this->spill(b)) {
+            this->resident += b.events.memory_usage();
+            return;
+        }
+
+        b.events = EventStore();
+        b.spilled = true;
+    }
+
+    // Block layout in the spill file: t, polarity words, x, y
+    bool spill (Block &b) {
+        if (this->spill_file == nullptr) {
+            this->spill_file = std::tmpfile();
+            if (this->spill_file == nullptr) {
+                std::cout << _red("EventArena: could not create a temporary file, keeping events in memory") << std::endl;
+                this->memory_cap = 0;
+                return false;
+            }
+        }
+
+        size_t n = b.count;
+        std::fseek(this->spill_file, 0, SEEK_END);
+        b.offset = std::ftell(this->spill_file);
+        bool ok = std::fwrite(b.events.ts_data(), sizeof(ull), n, this->spill_file) == n &&
+                  std::fwrite(b.events.polarity_data(), sizeof(uint64_t), (n + 63) / 64, this->spill_file) == (n + 63) / 64 &&
+                  std::fwrite(b.events.x_data(), sizeof(uint16_t), n, this->spill_file) == n &&
+                  std::fwrite(b.events.y_data(), sizeof(uint16_t), n, this->spill_file) == n;
+        if (!ok) std::cout << _red("EventArena: error writing the spill file, keeping the block in memory") << std::endl;
+        return ok;
+    }
+
+    bool load (const Block &b, EventStore &events) const {
+        size_t n = b.count, n_words = (n + 63) / 64;
+        auto buf = std::make_shared<std::vector<uint64_t>>(n + n_words + (n + 3) / 4 * 2);
+        uint64_t *t = buf->data(), *pol = t + n;
+        uint16_t *x = reinterpret_cast<uint16_t*>(pol + n_words), *y = x + (n + 3) / 4 * 4;
+
+        std::fseek(this->spill_file, b.offset, SEEK_SET);
+        bool ok = std::fread(t, sizeof(ull), n, this->spill_file) == n &&
+                  std::fread(pol, sizeof(uint64_t), n_words, this->spill_file) == n_words &&
+                  std::fread(x, sizeof(uint16_t), n, this->spill_file) == n &&
+                  std::fread(y, sizeof(uint16_t), n, this->spill_file) == n;
+        if (!ok) {
+            std::cout << _red("EventArena: error reading the spill file") << std::endl;
+            return false;
+        }
+
+        events.attach(n, x, y, reinterpret_cast<const ull*>(t), pol, buf);
+        return true;
+    }
+};
+
+
+#endif // EVENT_ARENA_H
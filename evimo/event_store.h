@@ -0,0 +1,353 @@
+#ifndef EVENT_STORE_H
+#define EVENT_STORE_H
+
+#include <cstdint>
+#include <memory>
+
+#include <common.h>
+#include <event.h>
+
+
+// Storage for a single EventStore column: either an owned vector or a view of
+// memory kept alive by someone else (e.g. a memory-mapped cache file). The
+// first write to an external column copies it into owned memory
+template <class T> class EventColumn {
+protected:
+    std::vector<T> owned;
+    const T *ext_data;
+    size_t ext_size;
+
+public:
+    typedef T value_type;
+
+    EventColumn () : ext_data(nullptr), ext_size(0) {}
+
+    void attach (const T *data_, size_t size_) {
+        this->owned = std::vector<T>();
+        this->ext_data = data_;
+        this->ext_size = size_;
+    }
+
+    inline bool is_external () const {return this->ext_data != nullptr; }
+    inline size_t size () const {return this->is_external() ? this->ext_size : this->owned.size(); }
+    inline size_t capacity () const {return this->owned.capacity(); }
+    inline const T *data () const {return this->is_external() ? this->ext_data : this->owned.data(); }
+    inline const T &operator [] (size_t idx) const {return this->data()[idx]; }
+
+    inline T *mutable_data () {
+        if (this->is_external()) this->detach();
+        return this->owned.data();
+    }
+
+    void clear () {
+        this->owned.clear();
+        this->ext_data = nullptr;
+        this->ext_size = 0;
+    }
+    void reserve (size_t n) {this->detach(); this->owned.reserve(n); }
+    void resize (size_t n, T v) {this->detach(); this->owned.resize(n, v); }
+
+    inline void push_back (T v) {
+        if (this->is_external()) this->detach();
+        this->owned.push_back(v);
+    }
+
+    void append (const T *v, size_t n) {
+        this->detach();
+        this->owned.insert(this->owned.end(), v, v + n);
+    }
+
+protected:
+    void detach () {
+        if (!this->is_external()) return;
+        this->owned.assign(this->ext_data, this->ext_data + this->ext_size);
+        this->ext_data = nullptr;
+        this->ext_size = 0;
+    }
+};
+
+
+// Columnar (structure-of-arrays) event container: 16-bit coordinates,
+// 64-bit timestamps and a packed polarity bitset - about 12 bytes per
+// event instead of 32 for std::vector<Event>
+class EventStore {
+friend class CompressedEventStore;
+protected:
+    EventColumn<uint16_t> x_col, y_col;
+    EventColumn<ull> ts_col;
+    EventColumn<uint64_t> pol_col;
+    size_t current_size;
+
+    // Keeps the memory of attached (external) columns alive
+    std::shared_ptr<void> external_owner;
+
+    // Coarse time index: time_index[k] is the first event with
+    // timestamp >= index_t0 + k * index_bucket
+    std::vector<size_t> time_index;
+    ull index_t0, index_bucket;
+
+public:
+    // A non-virtual view of a single event; exposes the same fields as
+    // Event, so templated consumers (EventFile, Slice, TimeSlice) work unchanged
+    class EventView {
+    public:
+        uint fr_x, fr_y;
+        char polarity;
+        ull timestamp;
+
+        double get_ts_sec () const {return (long double)timestamp / 1000000000.0; }
+        inline uint get_x () const {return this->fr_x; }
+        inline uint get_y () const {return this->fr_y; }
+    };
+
+    typedef EventView value_type;
+
+    EventStore () : current_size(0), index_t0(0), index_bucket(0) {}
+
+    inline size_t size () const {return this->current_size; }
+    inline bool empty () const {return this->current_size == 0; }
+
+    void clear () {
+        this->x_col.clear();
+        this->y_col.clear();
+        this->ts_col.clear();
+        this->pol_col.clear();
+        this->current_size = 0;
+        this->time_index.clear();
+        this->external_owner.reset();
+    }
+
+    // Use externally owned columns without copying them; polarity is a bitset
+    // in the same layout as pol_col. 'owner' is held for as long as the data is used
+    void attach (size_t n, const uint16_t *x, const uint16_t *y, const ull *t,
+                 const uint64_t *pol, std::shared_ptr<void> owner) {
+        this->clear();
+        this->x_col.attach(x, n);
+        this->y_col.attach(y, n);
+        this->ts_col.attach(t, n);
+        this->pol_col.attach(pol, (n + 63) / 64);
+        this->current_size = n;
+        this->external_owner = owner;
+    }
+
+    bool is_external () const {return this->ts_col.is_external(); }
+
+    void reserve (size_t n) {
+        this->x_col.reserve(n);
+        this->y_col.reserve(n);
+        this->ts_col.reserve(n);
+        this->pol_col.reserve((n + 63) / 64);
+    }
+
+    void resize (size_t n) {
+        this->x_col.resize(n, 0);
+        this->y_col.resize(n, 0);
+        this->ts_col.resize(n, 0);
+        this->pol_col.resize((n + 63) / 64, 0);
+        this->current_size = n;
+        this->time_index.clear();
+    }
+
+    inline void push_back (uint x, uint y, ull t, char pol) {
+        if (this->current_size % 64 == 0)
+            this->pol_col.push_back(0);
+        this->x_col.push_back(0);
+        this->y_col.push_back(0);
+        this->ts_col.push_back(0);
+        this->current_size ++;
+        if (!this->time_index.empty()) this->time_index.clear();
+        this->set(this->current_size - 1, x, y, t, pol);
+    }
+
+    inline void push_back (const Event &e) {
+        this->push_back(e.fr_x, e.fr_y, e.timestamp, e.polarity);
+    }
+
+    // Bulk copy of another store to the end of this one; whole columns
+    // are copied when this store's size is a multiple of 64
+    void append (const EventStore &other) {
+        if (this->current_size % 64 != 0) {
+            for (size_t i = 0; i < other.size(); ++i)
+                this->push_back(other.get_x(i), other.get_y(i), other.get_ts(i), other.get_polarity(i));
+            return;
+        }
+
+        size_t n = other.size();
+        this->x_col.append(other.x_data(), n);
+        this->y_col.append(other.y_data(), n);
+        this->ts_col.append(other.ts_data(), n);
+        this->pol_col.append(other.polarity_data(), (n + 63) / 64);
+        this->current_size += n;
+        this->time_index.clear();
+    }
+
+    inline void set (size_t idx, uint x, uint y, ull t, char pol) {
+        assert(idx < this->current_size);
+        assert(x <= UINT16_MAX && y <= UINT16_MAX);
+        this->x_col.mutable_data()[idx] = x;
+        this->y_col.mutable_data()[idx] = y;
+        this->ts_col.mutable_data()[idx] = t;
+        uint64_t bit = uint64_t(1) << (idx % 64);
+        if (pol) this->pol_col.mutable_data()[idx / 64] |= bit;
+        else     this->pol_col.mutable_data()[idx / 64] &= ~bit;
+    }
+
+    // Column accessors
+    inline uint get_x (size_t idx) const {return this->x_col[idx]; }
+    inline uint get_y (size_t idx) const {return this->y_col[idx]; }
+    inline ull  get_ts (size_t idx) const {return this->ts_col[idx]; }
+    inline char get_polarity (size_t idx) const {return (this->pol_col[idx / 64] >> (idx % 64)) & 1; }
+    inline double get_ts_sec (size_t idx) const {return (long double)this->ts_col[idx] / 1000000000.0; }
+
+    inline EventView operator [] (size_t idx) const {
+        assert(idx < this->current_size);
+        EventView v;
+        v.fr_x = this->x_col[idx];
+        v.fr_y = this->y_col[idx];
+        v.polarity = this->get_polarity(idx);
+        v.timestamp = this->ts_col[idx];
+        return v;
+    }
+
+    const uint16_t *x_data () const {return this->x_col.data(); }
+    const uint16_t *y_data () const {return this->y_col.data(); }
+    const ull *ts_data () const {return this->ts_col.data(); }
+    const uint64_t *polarity_data () const {return this->pol_col.data(); }
+
+    // Shift all timestamps back by t (nanoseconds)
+    void subtract_time (ull t) {
+        ull *ts = this->ts_col.mutable_data();
+        for (size_t i = 0; i < this->current_size; ++i) ts[i] -= t;
+        this->index_t0 -= t;
+    }
+
+    // Build the bucket index; timestamps are expected to be sorted.
+    // Has to be rebuilt after the store is modified
+    void build_time_index (ull bucket_ns = FROM_MS(1)) {
+        this->time_index.clear();
+        if (this->current_size == 0 || bucket_ns == 0) return;
+
+        this->index_bucket = bucket_ns;
+        this->index_t0 = this->ts_col[0];
+        ull n_buckets = (this->ts_col[this->current_size - 1] - this->index_t0) / bucket_ns + 1;
+        this->time_index.reserve(n_buckets + 1);
+
+        size_t id = 0;
+        for (ull k = 0; k <= n_buckets; ++k) {
+            ull bucket_start = this->index_t0 + k * bucket_ns;
+            while (id < this->current_size && this->ts_col[id] < bucket_start) id ++;
+            this->time_index.push_back(id);
+        }
+    }
+
+    bool has_time_index () const {return !this->time_index.empty(); }
+
+    // A search hint for TimeSlice: the last event at or before the start of the
+    // bucket containing ts_sec, so the nearest event is a short forward walk away
+    size_t index_hint (double ts_sec, size_t hint) const {
+        if (this->time_index.empty()) return hint;
+
+        double ns = ts_sec * 1000000000.0;
+        if (ns <= double(this->index_t0)) return 0;
+        ull k = ull(ns - double(this->index_t0)) / this->index_bucket;
+        if (k >= this->time_index.size()) k = this->time_index.size() - 1;
+
+        size_t id = this->time_index[k];
+        if (id > 0) id --;
+        return std::min(id, this->current_size - 1);
+    }
+
+    size_t memory_usage () const {
+        return this->x_col.capacity() * sizeof(uint16_t) + this->y_col.capacity() * sizeof(uint16_t) +
+               this->ts_col.capacity() * sizeof(ull) + this->pol_col.capacity() * sizeof(uint64_t);
+    }
+
+    inline auto begin() {return _ESiterator(this, 0); }
+    inline auto end()   {return _ESiterator(this, this->current_size); }
+
+protected:
+    // The iterator decodes the current event into a view it owns; the
+    // reference returned by operator* is valid until the iterator moves
+    class _ESiterator {
+    friend class EventStore;
+    public:
+        EventView& operator *() {this->load(); return this->view; }
+        EventView* operator->() {this->load(); return &(this->view); }
+
+        _ESiterator& operator ++() {
+            this->idx ++;
+            return *this;
+        }
+
+        _ESiterator operator +(size_t n) const {
+            return _ESiterator(this->store, this->idx + n);
+        }
+
+        bool operator !=(const _ESiterator &other) const {
+            return this->idx != other.idx;
+        }
+
+        bool operator ==(const _ESiterator &other) const {
+            return this->idx == other.idx;
+        }
+
+    protected:
+        _ESiterator(const EventStore *store_, size_t idx_)
+            : store(store_), idx(idx_) {}
+
+        inline void load() {this->view = (*this->store)[this->idx]; }
+
+    private:
+        const EventStore *store;
+        size_t idx;
+        EventView view;
+    };
+};
+
+
+// Append-only event buffer for when the number of events is not known up
+// front: events go to fixed-size chunks, so nothing is reallocated or copied
+// while the buffer grows; finalize() moves them into a contiguous EventStore
+class EventStoreBuilder {
+protected:
+    std::vector<EventStore> chunks;
+    size_t chunk_size, total;
+
+public:
+    // The chunk size is rounded up to a multiple of 64 so chunks can be appended column-wise
+    EventStoreBuilder (size_t chunk_size_ = 1 << 20)
+        : chunk_size((std::max(chunk_size_, size_t(1)) + 63) / 64 * 64), total(0) {}
+
+    inline size_t size () const {return this->total; }
+
+    inline void push_back (uint x, uint y, ull t, char pol) {
+        if (this->chunks.empty() || this->chunks.back().size() >= this->chunk_size) {
+            this->chunks.emplace_back();
+            this->chunks.back().reserve(this->chunk_size);
+        }
+
+        this->chunks.back().push_back(x, y, t, pol);
+        this->total ++;
+    }
+
+    // Chunks are released as soon as they are copied, so the resident memory
+    // stays close to a single copy of the events
+    void finalize (EventStore &store) {
+        store.clear();
+        store.reserve(this->total);
+        this->append_to(store);
+    }
+
+    void append_to (EventStore &store) {
+        for (auto &chunk : this->chunks) {
+            store.append(chunk);
+            chunk = EventStore();
+        }
+
+        this->chunks.clear();
+        this->total = 0;
+    }
+};
+
+
+#endif // EVENT_STORE_H
@@ -0,0 +1,469 @@
+#ifndef EVENT_WRITER_H
+#define EVENT_WRITER_H
+
+#include <cstdint>
+#include <fstream>
+#include <deque>
+#include <future>
+#include <thread>
+
+#include <common.h>
+#include <event_store.h>
+#include <mapped_file.h>
+#include <undistortion.h>
+
+
+// Binary columnar event file ('events.bin'), little-endian:
+//   preamble:  char magic[8] = "EVIMOEVB", uint32 version, uint32 n_sections,
+//              uint64 n_events, uint64 index_t0 (ns), uint64 index_bucket (ns)
+//   sections:  n_sections x {char name[8], uint64 offset, uint64 size}
+//   't'     - uint64[n_events], timestamps in ns
+//   'x', 'y' - uint16[n_events], same column order as events.txt
+//   'p'     - polarity bitset, uint64 words, event i is bit (i % 64) of word i / 64
+//   'index' - uint64[n_buckets + 1], index of the first event with
+//             t >= index_t0 + k * index_bucket; the last entry is n_events
+//   'x_rect', 'y_rect' - float32[n_events], optional: undistorted x / y (see
+//             UndistortionMap), NaN where the distortion can not be inverted
+// All sections are 8-byte aligned, so every column can be memory-mapped.
+// When the number of events is not known in advance, the columns after 't'
+// are spilled to temporary files and copied into place on close().
+class EventBinWriter {
+public:
+    static constexpr uint32_t VERSION = 1;
+    static constexpr size_t BLOCK = 1 << 16; // events buffered per column
+    static constexpr uint64_t UNKNOWN_SIZE = UINT64_MAX;
+
+    struct Section {
+        char name[8];
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    enum {S_T = 0, S_X, S_Y, S_P, S_INDEX, S_XR, S_YR, N_SECTIONS};
+
+protected:
+    std::string fname;
+    std::ofstream file;
+    uint64_t n_events, written;
+    uint64_t dropped; // events past n_events, reported once and counted on close()
+    ull bucket_ns, t0;
+    Section sections[N_SECTIONS];
+
+    std::vector<ull> t_buf;
+    std::vector<uint16_t> x_buf, y_buf;
+    std::vector<uint64_t> p_buf;
+    std::vector<float> xr_buf, yr_buf;
+    std::vector<uint64_t> index;
+
+    // Writes 'x_rect' / 'y_rect' when set
+    const UndistortionMap *rect;
+
+    // Spilled columns, for UNKNOWN_SIZE
+    std::ofstream spill[N_SECTIONS];
+
+public:
+    EventBinWriter(std::string fname_, uint64_t n_events_ = UNKNOWN_SIZE, ull bucket_ns_ = FROM_MS(1),
+                   const UndistortionMap *rect_ = nullptr)
+        : fname(fname_), n_events(n_events_), written(0), dropped(0), bucket_ns(bucket_ns_), t0(0), rect(rect_) {
+        if (this->bucket_ns == 0) this->bucket_ns = FROM_MS(1);
+        this->layout(this->unknown_size() ? 0 : this->n_events);
+
+        this->file.open(this->fname, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+        if (!this->file.is_open()) {
+            std::cout << _red("Could not open ") << this->fname << _red(" for writing!") << std::endl;
+            return;
+        }
+
+        for (int sid = S_X; sid < this->n_sections() && this->unknown_size(); ++sid) {
+            if (sid == S_INDEX) continue;
+            this->spill[sid].open(this->spill_fname(sid), std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+            if (!this->spill[sid].is_open()) {
+                std::cout << _red("Could not open ") << this->spill_fname(sid) << _red(" for writing!") << std::endl;
+                this->file.close();
+                return;
+            }
+        }
+
+        this->t_buf.reserve(BLOCK);
+        this->x_buf.reserve(BLOCK);
+        this->y_buf.reserve(BLOCK);
+        this->p_buf.reserve(BLOCK / 64);
+        if (this->rect != nullptr) {
+            this->xr_buf.reserve(BLOCK);
+            this->yr_buf.reserve(BLOCK);
+        }
+    }
+
+    ~EventBinWriter() {
+        if (this->file.is_open()) this->close();
+    }
+
+    bool is_open() const {return this->file.is_open(); }
+
+    // Anything iterable with Event-like elements (Event, EventStore::EventView)
+    template<class T> void append(T &events) {
+        for (auto &e : events)
+            this->push_back(e.fr_y, e.fr_x, e.timestamp, e.polarity);
+    }
+
+    // x and y here are in the events.txt order
+    inline void push_back(uint x, uint y, ull t, char pol) {
+        if (this->written + this->t_buf.size() >= this->n_events) {
+            if (this->dropped++ == 0)
+                std::cout << _red("EventBinWriter: more events than declared (")
+                          << this->n_events << "), the rest is dropped" << std::endl;
+            return;
+        }
+
+        uint64_t id = this->written + this->t_buf.size();
+        if (id == 0) {
+            this->t0 = t;
+            this->index.push_back(0);
+        }
+        while (t >= this->t0 + this->index.size() * this->bucket_ns)
+            this->index.push_back(id);
+
+        if (id % 64 == 0) this->p_buf.push_back(0);
+        if (pol) this->p_buf.back() |= uint64_t(1) << (id % 64);
+
+        this->t_buf.push_back(t);
+        this->x_buf.push_back(x);
+        this->y_buf.push_back(y);
+        if (this->rect != nullptr) {
+            float x_rect, y_rect;
+            this->rect->rectify(x, y, x_rect, y_rect);
+            this->xr_buf.push_back(x_rect);
+            this->yr_buf.push_back(y_rect);
+        }
+        if (this->t_buf.size() >= BLOCK) this->flush();
+    }
+
+    bool close() {
+        if (!this->file.is_open()) return false;
+        this->flush();
+
+        if (!this->unknown_size() && this->written != this->n_events) {
+            std::cout << _yellow("EventBinWriter: ") << this->written << " events written, "
+                      << this->n_events << " declared" << std::endl;
+        }
+        if (this->dropped > 0) {
+            std::cout << _red("EventBinWriter: ") << this->dropped << " events past the declared "
+                      << this->n_events << " were dropped" << std::endl;
+        }
+
+        if (this->unknown_size()) {
+            this->layout(this->written);
+            for (int sid = S_X; sid < this->n_sections(); ++sid)
+                if (sid != S_INDEX) this->copy_spilled(sid);
+        }
+
+        this->sections[S_T].size = this->written * sizeof(ull);
+        this->sections[S_X].size = this->written * sizeof(uint16_t);
+        this->sections[S_Y].size = this->written * sizeof(uint16_t);
+        this->sections[S_P].size = (this->written + 63) / 64 * sizeof(uint64_t);
+        this->sections[S_XR].size = this->written * sizeof(float);
+        this->sections[S_YR].size = this->written * sizeof(float);
+
+        int last = (this->rect != nullptr) ? S_YR : S_P;
+        this->index.push_back(this->written);
+        this->sections[S_INDEX].offset = (this->sections[last].offset + this->sections[last].size + 7) / 8 * 8;
+        this->sections[S_INDEX].size = this->index.size() * sizeof(uint64_t);
+        this->file.seekp(this->sections[S_INDEX].offset);
+        this->file.write(reinterpret_cast<const char*>(this->index.data()), this->sections[S_INDEX].size);
+
+        this->file.seekp(0);
+        this->write_header();
+
+        bool ok = this->file.good();
+        this->file.close();
+        if (!ok) std::cout << _red("Error writing ") << this->fname << std::endl;
+        return ok;
+    }
+
+    uint64_t header_size() const {
+        return 8 + 2 * sizeof(uint32_t) + 3 * sizeof(uint64_t) + this->n_sections() * sizeof(Section);
+    }
+
+protected:
+    bool unknown_size() const {return this->n_events == UNKNOWN_SIZE; }
+
+    // The rectified columns are listed after 'index' in the header, so files
+    // without them are the same as before
+    int n_sections() const {return (this->rect != nullptr) ? N_SECTIONS : S_XR; }
+
+    std::string spill_fname(int sid) const {return this->fname + "." + this->sections[sid].name + ".tmp"; }
+
+    // 't' always starts right after the header, so it is written in place;
+    // the data sections are stored in the enum order, 'index' goes last
+    void layout(uint64_t n) {
+        uint64_t offset = this->header_size();
+        this->init_section(S_T, "t", offset, n * sizeof(ull));
+        this->init_section(S_X, "x", offset, n * sizeof(uint16_t));
+        this->init_section(S_Y, "y", offset, n * sizeof(uint16_t));
+        this->init_section(S_P, "p", offset, (n + 63) / 64 * sizeof(uint64_t));
+        this->init_section(S_XR, "x_rect", offset, (this->rect != nullptr) ? n * sizeof(float) : 0);
+        this->init_section(S_YR, "y_rect", offset, (this->rect != nullptr) ? n * sizeof(float) : 0);
+        this->init_section(S_INDEX, "index", offset, 0);
+    }
+
+    void copy_spilled(int sid) {
+        this->spill[sid].close();
+        std::ifstream in(this->spill_fname(sid), std::ifstream::in | std::ifstream::binary);
+        this->file.seekp(this->sections[sid].offset);
+
+        std::vector<char> buf(1 << 20);
+        while (in.read(buf.data(), buf.size()) || in.gcount() > 0)
+            this->file.write(buf.data(), in.gcount());
+        in.close();
+        std::remove(this->spill_fname(sid).c_str());
+    }
+
+    void init_section(int id, const char *name, uint64_t &offset, uint64_t size) {
+        std::memset(this->sections[id].name, 0, sizeof(this->sections[id].name));
+        std::strncpy(this->sections[id].name, name, sizeof(this->sections[id].name));
+        this->sections[id].offset = offset;
+        this->sections[id].size = size;
+        offset += (size + 7) / 8 * 8;
+    }
+
+    void write_header() {
+        uint32_t version = VERSION, n_sections = this->n_sections();
+        uint64_t n = this->written;
+        this->file.write("EVIMOEVB", 8);
+        this->file.write(reinterpret_cast<const char*>(&version), sizeof(version));
+        this->file.write(reinterpret_cast<const char*>(&n_sections), sizeof(n_sections));
+        this->file.write(reinterpret_cast<const char*>(&n), sizeof(n));
+        this->file.write(reinterpret_cast<const char*>(&this->t0), sizeof(this->t0));
+        this->file.write(reinterpret_cast<const char*>(&this->bucket_ns), sizeof(this->bucket_ns));
+        this->file.write(reinterpret_cast<const char*>(this->sections), n_sections * sizeof(Section));
+    }
+
+    template<class V> void write_column(int sid, const V &buf, uint64_t first) {
+        typedef typename V::value_type D;
+        if (this->unknown_size() && sid != S_T) {
+            this->spill[sid].write(reinterpret_cast<const char*>(buf.data()), buf.size() * sizeof(D));
+            return;
+        }
+
+        this->file.seekp(this->sections[sid].offset + first * sizeof(D));
+        this->file.write(reinterpret_cast<const char*>(buf.data()), buf.size() * sizeof(D));
+    }
+
+    // Blocks are a multiple of 64 events, so polarity words never straddle a flush
+    void flush() {
+        if (this->t_buf.size() == 0) return;
+        this->write_column(S_T, this->t_buf, this->written);
+        this->write_column(S_X, this->x_buf, this->written);
+        this->write_column(S_Y, this->y_buf, this->written);
+        this->write_column(S_P, this->p_buf, this->written / 64);
+        if (this->rect != nullptr) {
+            this->write_column(S_XR, this->xr_buf, this->written);
+            this->write_column(S_YR, this->yr_buf, this->written);
+            this->xr_buf.clear();
+            this->yr_buf.clear();
+        }
+
+        this->written += this->t_buf.size();
+        this->t_buf.clear();
+        this->x_buf.clear();
+        this->y_buf.clear();
+        this->p_buf.clear();
+    }
+};
+
+
+// Memory-mapped events.bin reader; the columns can be attached to an
+// EventStore without copying, pages are loaded lazily on first access
+class EventBinReader {
+protected:
+    std::string fname;
+    std::shared_ptr<MappedFile> file;
+    uint64_t n_events;
+    std::map<std::string, EventBinWriter::Section> sections;
+
+public:
+    EventBinReader(std::string fname_)
+        : fname(fname_), n_events(0) {
+        this->file = std::make_shared<MappedFile>(this->fname);
+        if (!this->file->is_open() || !this->parse_header()) {
+            this->file.reset();
+            this->sections.clear();
+        }
+    }
+
+    bool is_open() const {return bool(this->file); }
+    uint64_t size() const {return this->n_events; }
+
+    // Pointer to a section, or nullptr if it is missing or too small
+    template<class D> const D *column(std::string name, uint64_t count) const {
+        auto s = this->sections.find(name);
+        if (!this->is_open() || s == this->sections.end() || s->second.size < count * sizeof(D))
+            return nullptr;
+        return reinterpret_cast<const D*>(this->file->data() + s->second.offset);
+    }
+
+    // The store will share ownership of the mapping
+    bool read(EventStore &store) const {
+        uint64_t n = this->n_events;
+        auto t = this->column<ull>("t", n);
+        auto x = this->column<uint16_t>("x", n);
+        auto y = this->column<uint16_t>("y", n);
+        auto p = this->column<uint64_t>("p", (n + 63) / 64);
+        if (t == nullptr || x == nullptr || y == nullptr || p == nullptr) {
+            std::cout << _red("Corrupted events file: ") << this->fname << std::endl;
+            return false;
+        }
+
+        // events.bin follows the events.txt column order
+        store.attach(n, y, x, t, p, this->file);
+        return true;
+    }
+
+protected:
+    bool parse_header() {
+        auto data = this->file->data();
+        if (this->file->size() < 40 || std::memcmp(data, "EVIMOEVB", 8) != 0) return false;
+
+        uint32_t version = 0, n_sections = 0;
+        std::memcpy(&version, data + 8, sizeof(version));
+        std::memcpy(&n_sections, data + 12, sizeof(n_sections));
+        std::memcpy(&this->n_events, data + 16, sizeof(this->n_events));
+        if (version != EventBinWriter::VERSION) return false;
+        if (40 + uint64_t(n_sections) * sizeof(EventBinWriter::Section) > this->file->size()) return false;
+
+        for (uint32_t i = 0; i < n_sections; ++i) {
+            EventBinWriter::Section s;
+            std::memcpy(&s, data + 40 + i * sizeof(s), sizeof(s));
+            if (s.offset + s.size > this->file->size() || s.offset % 8 != 0) return false;
+            this->sections[std::string(s.name, strnlen(s.name, sizeof(s.name)))] = s;
+        }
+        return true;
+    }
+};
+
+
+// events.txt writer: fixed-size blocks of events are formatted in parallel
+// (without iostreams or locale) and written out in order; at most
+// max_in_flight blocks are kept in memory at any time
+class EventTxtWriter {
+public:
+    static constexpr size_t BLOCK = 1 << 16;
+
+protected:
+    struct RawEvent {
+        ull t;
+        uint16_t x, y;
+        char p;
+    };
+
+    std::string fname;
+    std::ofstream file;
+    ull ts_quantum;
+    size_t max_in_flight;
+    std::vector<RawEvent> block;
+    std::deque<std::future<std::string>> in_flight;
+
+public:
+    // Timestamps are truncated to a multiple of ts_quantum_ns before formatting
+    EventTxtWriter(std::string fname_, ull ts_quantum_ns = 1, size_t max_in_flight_ = 0)
+        : fname(fname_), ts_quantum(std::max(ts_quantum_ns, ull(1))), max_in_flight(max_in_flight_) {
+        if (this->max_in_flight == 0)
+            this->max_in_flight = 2 * std::max(std::thread::hardware_concurrency(), 1u);
+
+        this->file.open(this->fname, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+        if (!this->file.is_open()) {
+            std::cout << _red("Could not open ") << this->fname << _red(" for writing!") << std::endl;
+            return;
+        }
+
+        this->block.reserve(BLOCK);
+    }
+
+    ~EventTxtWriter() {
+        if (this->file.is_open()) this->close();
+    }
+
+    bool is_open() const {return this->file.is_open(); }
+
+    // Anything iterable with Event-like elements (Event, EventStore::EventView)
+    template<class T> void append(T &events) {
+        for (auto &e : events)
+            this->push_back(e.fr_y, e.fr_x, e.timestamp, e.polarity);
+    }
+
+    // x and y here are in the events.txt order
+    inline void push_back(uint x, uint y, ull t, char pol) {
+        this->block.push_back({t, uint16_t(x), uint16_t(y), pol});
+        if (this->block.size() >= BLOCK) this->submit();
+    }
+
+    bool close() {
+        if (!this->file.is_open()) return false;
+        this->submit();
+        while (this->in_flight.size() > 0)
+            this->write_front();
+
+        bool ok = this->file.good();
+        this->file.close();
+        if (!ok) std::cout << _red("Error writing ") << this->fname << std::endl;
+        return ok;
+    }
+
+protected:
+    void submit() {
+        if (this->block.size() == 0) return;
+        if (this->in_flight.size() >= this->max_in_flight)
+            this->write_front();
+
+        this->in_flight.push_back(std::async(std::launch::async, &EventTxtWriter::format,
+                                             std::move(this->block), this->ts_quantum));
+        this->block = std::vector<RawEvent>();
+        this->block.reserve(BLOCK);
+    }
+
+    void write_front() {
+        auto str = this->in_flight.front().get();
+        this->in_flight.pop_front();
+        this->file.write(str.data(), str.size());
+    }
+
+    // 't.ttttttttt x y p\n' - same output as std::fixed << std::setprecision(9)
+    static std::string format(std::vector<RawEvent> events, ull quantum) {
+        std::string ret(events.size() * 48, '\0');
+        char *p = &ret[0];
+        for (auto &e : events) {
+            ull t = e.t / quantum * quantum;
+            p = format_uint(p, t / 1000000000);
+            *p++ = '.';
+            ull frac = t % 1000000000;
+            for (int i = 8; i >= 0; --i) {
+                p[i] = '0' + frac % 10;
+                frac /= 10;
+            }
+            p += 9;
+            *p++ = ' ';
+            p = format_uint(p, e.x);
+            *p++ = ' ';
+            p = format_uint(p, e.y);
+            *p++ = ' ';
+            *p++ = e.p ? '1' : '0';
+            *p++ = '\n';
+        }
+        ret.resize(p - &ret[0]);
+        return ret;
+    }
+
+    static inline char *format_uint(char *p, ull v) {
+        char tmp[20];
+        int n = 0;
+        do {
+            tmp[n++] = '0' + v % 10;
+            v /= 10;
+        } while (v > 0);
+        while (n > 0) *p++ = tmp[--n];
+        return p;
+    }
+};
+
+
+#endif // EVENT_WRITER_H
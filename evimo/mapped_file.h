@@ -0,0 +1,50 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <cstdint>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+// Private (copy-on-write) memory mapping of a whole file; pages are only
+// read from disk when touched, writes never reach the file
+class MappedFile {
+protected:
+    void *addr;
+    size_t length;
+
+public:
+    MappedFile(std::string fname)
+        : addr(nullptr), length(0) {
+        int fd = ::open(fname.c_str(), O_RDONLY);
+        if (fd < 0) return;
+
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *p = ::mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                this->addr = p;
+                this->length = st.st_size;
+            }
+        }
+        ::close(fd);
+    }
+
+    ~MappedFile() {
+        if (this->addr != nullptr) ::munmap(this->addr, this->length);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool is_open() const {return this->addr != nullptr; }
+    size_t size() const {return this->length; }
+    uint8_t *data() const {return static_cast<uint8_t*>(this->addr); }
+};
+
+
+#endif // MAPPED_FILE_H
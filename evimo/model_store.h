@@ -0,0 +1,66 @@
+#ifndef MODEL_STORE_H
+#define MODEL_STORE_H
+
+#include <map>
+#include <mutex>
+#include <memory>
+#include <string>
+
+#include <ros/ros.h>
+
+#include <object.h>
+
+
+// The room and object models, loaded on first use and shared by all the
+// datasets of a process. The models are only read while frames are generated
+// (see Dataset::background_matrix / Dataset::object_matrix), so one copy can
+// serve any number of sequences at once
+class ModelStore {
+protected:
+    std::string folder;
+    ros::NodeHandle *nh;
+
+    std::mutex lock;
+    std::shared_ptr<StaticObject> background;
+    std::map<int, std::shared_ptr<ViObject>> objects;
+
+public:
+    // Object id to the model folder name under 'objects/'
+    static const std::map<int, std::string> &object_names () {
+        static const std::map<int, std::string> names = {{1, "toy_car"}, {2, "toy_plane"}, {3, "cup"}};
+        return names;
+    }
+
+    // Without a node handle the objects do not publish or subscribe to anything
+    ModelStore (std::string folder_, ros::NodeHandle *nh_ = nullptr)
+        : folder(folder_), nh(nh_) {}
+
+    ModelStore (const ModelStore&) = delete;
+    ModelStore& operator = (const ModelStore&) = delete;
+
+    std::shared_ptr<StaticObject> get_background () {
+        std::lock_guard<std::mutex> guard(this->lock);
+        if (!this->background)
+            this->background = std::make_shared<StaticObject>(this->folder + "/room");
+        return this->background;
+    }
+
+    // nullptr for an unknown id
+    std::shared_ptr<ViObject> get_object (int id) {
+        auto name = ModelStore::object_names().find(id);
+        if (name == ModelStore::object_names().end())
+            return nullptr;
+
+        std::lock_guard<std::mutex> guard(this->lock);
+        auto &obj = this->objects[id];
+        if (!obj) {
+            std::string path = this->folder + "/" + name->second;
+            if (this->nh != nullptr) obj = std::make_shared<ViObject>(*(this->nh), path, id);
+            else obj = std::make_shared<ViObject>(path, id);
+        }
+        return obj;
+    }
+};
+
+
+#endif // MODEL_STORE_H
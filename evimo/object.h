@@ -39,12 +39,31 @@
 
 
 #include "running_average.h"
+#include "point_buffer.h"
+#include "bvh.h"
 
 
 #ifndef OBJECT_H
 #define OBJECT_H
 
 
+// Vertex index triples of a polygon mesh; polygons are split into fans
+inline std::vector<uint32_t> triangulate(const std::vector<pcl::Vertices> &polygons, size_t n_vertices) {
+    std::vector<uint32_t> ret;
+    for (auto &poly : polygons) {
+        auto &v = poly.vertices;
+        if (std::any_of(v.begin(), v.end(), [n_vertices](uint32_t i) {return i >= n_vertices; }))
+            continue;
+        for (size_t i = 2; i < v.size(); ++i) {
+            ret.push_back(v[0]);
+            ret.push_back(v[i - 1]);
+            ret.push_back(v[i]);
+        }
+    }
+    return ret;
+}
+
+
 // Main class
 class StaticObject {
 protected:
@@ -54,6 +73,15 @@ protected:
     pcl::PointCloud<pcl::PointXYZRGB> *obj_cloud_transformed;
     pcl::PointCloud<pcl::PointXYZRGB> *obj_cloud_camera_frame;
 
+    // x / y / z of obj_cloud, for offline processing; in bvh order
+    PointBuffer model;
+    PointBVH bvh;
+
+    // Faces of the .ply model, if any, as vertex index triples into obj_cloud /
+    // mesh_vertices; for the mesh rendering mode
+    std::vector<uint32_t> triangles;
+    PointBuffer mesh_vertices;
+
     tf::Transform s_transform, last_to_camcenter;
 
 public:
@@ -77,12 +105,18 @@ public:
             pcl::io::loadPCDFile(this->cloud_fname, *(this->obj_cloud));
         } else if (fext == "ply") {
             std::cout << "Reading as .ply...\n";
-            pcl::io::loadPLYFile(this->cloud_fname, *(this->obj_cloud));
+            pcl::PolygonMesh mesh;
+            pcl::io::loadPLYFile(this->cloud_fname, mesh);
+            pcl::fromPCLPointCloud2(mesh.cloud, *(this->obj_cloud));
+            this->triangles = triangulate(mesh.polygons, this->obj_cloud->size());
         } else {
             std::cout << "Unsupported file format: " << fext << "\n";
             return;
         }
-        std::cout << "Read " << obj_cloud->size() << " points\n";
+        std::cout << "Read " << obj_cloud->size() << " points, " << this->triangles.size() / 3 << " triangles\n";
+        this->model.assign(*(this->obj_cloud));
+        this->bvh.build(this->model);
+        if (!this->triangles.empty()) this->mesh_vertices.assign(*(this->obj_cloud));
 
         obj_cloud_camera_frame->header.frame_id = "/camera_center";
         obj_cloud->header.frame_id = "/vicon";
@@ -98,13 +132,20 @@ public:
         return true;
     }
 
-    // A separate method, for offline prcessing
-    auto transform_to_camframe(const tf::Transform &cam_tf) {
-        this->last_to_camcenter = cam_tf;
-        auto full_tf = this->get_tf_in_camera_frame(cam_tf);
-        auto out_cloud = std::make_shared<pcl::PointCloud<pcl::PointXYZRGB>>();
-        pcl_ros::transformPointCloud(*(this->obj_cloud), *(out_cloud), full_tf);
-        return out_cloud;
+    const PointBuffer &get_model() const {
+        return this->model;
+    }
+
+    const PointBVH &get_bvh() const {
+        return this->bvh;
+    }
+
+    const PointBuffer &get_mesh_vertices() const {
+        return this->mesh_vertices;
+    }
+
+    const std::vector<uint32_t> &get_triangles() const {
+        return this->triangles;
     }
 
     tf::Transform get_tf_in_camera_frame(const tf::Transform &cam_tf) {
@@ -131,8 +172,7 @@ public:
 
 class ViObject {
 protected:
-    ros::NodeHandle n_;
-    image_transport::ImageTransport it_;
+    std::shared_ptr<ros::NodeHandle> n_; // not set for offline processing
 
     std::string folder, name, cloud_fname, config_fname;
     int id;
@@ -145,6 +185,15 @@ protected:
     pcl::PointCloud<pcl::PointXYZRGB> *obj_cloud_camera_frame;
     pcl::PointCloud<pcl::PointXYZRGB> *obj_markerpos;
 
+    // x / y / z of obj_cloud, for offline processing; in bvh order
+    PointBuffer model;
+    PointBVH bvh;
+
+    // Faces of the .ply model, if any, as vertex index triples into obj_cloud /
+    // mesh_vertices; for the mesh rendering mode
+    std::vector<uint32_t> triangles;
+    PointBuffer mesh_vertices;
+
     //Eigen::Matrix4f LAST_SVD;
     vicon::Subject last_pos;
     long int poses_received;
@@ -152,8 +201,17 @@ protected:
     PoseManager pose_manager;
 
 public:
-    ViObject (ros::NodeHandle n_, std::string folder_, int id_) :
-        n_(n_), it_(n_), folder(folder_), id(id_),
+    ViObject (ros::NodeHandle n_, std::string folder_, int id_) : ViObject(folder_, id_) {
+        this->n_ = std::make_shared<ros::NodeHandle>(n_);
+        this->obj_pub = n_.advertise<pcl::PointCloud<pcl::PointXYZRGB>> ("/ev_imo/" + this->name, 100);
+        this->vis_pub = n_.advertise<visualization_msgs::MarkerArray>("/ev_imo/markers", 0);
+        this->obj_sub = n_.subscribe("/vicon/" + this->name, 0, &ViObject::vicon_pos_cb, this);
+    }
+
+    // The model alone, for offline processing: nothing is advertised or
+    // subscribed to, so no ROS master is needed
+    ViObject (std::string folder_, int id_) :
+        folder(folder_), id(id_),
         obj_cloud(new pcl::PointCloud<pcl::PointXYZRGB>),
         obj_cloud_transformed(new pcl::PointCloud<pcl::PointXYZRGB>),
         obj_cloud_camera_frame(new pcl::PointCloud<pcl::PointXYZRGB>),
@@ -163,10 +221,6 @@ public:
         this->name = "Object_" + std::to_string(this->id);
         std::cout << "Initializing " << this->name << std::endl;
 
-        this->obj_pub = n_.advertise<pcl::PointCloud<pcl::PointXYZRGB>> ("/ev_imo/" + this->name, 100);
-        this->vis_pub = n_.advertise<visualization_msgs::MarkerArray>("/ev_imo/markers", 0);
-        this->obj_sub = n_.subscribe("/vicon/" + this->name, 0, &ViObject::vicon_pos_cb, this);
-
         this->cloud_fname  = this->folder + "/model.ply";
         this->config_fname = this->folder + "/config.txt";
 
@@ -178,12 +232,18 @@ public:
             pcl::io::loadPCDFile(this->cloud_fname, *(this->obj_cloud));
         } else if (fext == "ply") {
             std::cout << "Reading as .ply...\n";
-            pcl::io::loadPLYFile(this->cloud_fname, *(this->obj_cloud));
+            pcl::PolygonMesh mesh;
+            pcl::io::loadPLYFile(this->cloud_fname, mesh);
+            pcl::fromPCLPointCloud2(mesh.cloud, *(this->obj_cloud));
+            this->triangles = triangulate(mesh.polygons, this->obj_cloud->size());
         } else {
             std::cout << "Unsupported file format: " << fext << "\n";
             return;
         }
-        std::cout << "Read " << obj_cloud->size() << " points\n";
+        std::cout << "Read " << obj_cloud->size() << " points, " << this->triangles.size() / 3 << " triangles\n";
+        this->model.assign(*(this->obj_cloud));
+        this->bvh.build(this->model);
+        if (!this->triangles.empty()) this->mesh_vertices.assign(*(this->obj_cloud));
 
         this->obj_cloud_camera_frame->header.frame_id = "/camera_center";
         this->obj_cloud_transformed->header.frame_id = "/camera_center";
@@ -240,7 +300,9 @@ public:
         this->vis_pub.publish(vis_markers);
     }
 
-    void convert_to_vicon_tf(const vicon::Subject& subject) {
+    // Model to the frame of the vicon track, from the marker positions of one
+    // vicon message; the model itself is not changed
+    tf::Transform cloud_to_vicon_tf(const vicon::Subject& subject) const {
         if (subject.occluded)
             std::cout << "Computing cloud_to_vicon_tf on occluded vicon track!" << std::endl;
 
@@ -265,9 +327,14 @@ public:
         trans_est_svd.estimateRigidTransformation(*(this->obj_markerpos), *target, SVD);
         auto svd_tf = ViObject::mat2tf(SVD);
         auto p = ViObject::subject2tf(subject);
-        auto inv_p = p.inverse();
+        return p.inverse() * svd_tf;
+    }
 
-        pcl_ros::transformPointCloud(*(this->obj_cloud), *(this->obj_cloud), inv_p * svd_tf);
+    void convert_to_vicon_tf(const vicon::Subject& subject) {
+        pcl_ros::transformPointCloud(*(this->obj_cloud), *(this->obj_cloud), this->cloud_to_vicon_tf(subject));
+        this->model.assign(*(this->obj_cloud));
+        this->bvh.build(this->model);
+        if (!this->triangles.empty()) this->mesh_vertices.assign(*(this->obj_cloud));
     }
 
     // Camera pose update
@@ -289,12 +356,20 @@ public:
         return true;
     }
 
-    // A separate method, for offline prcessing
-    auto transform_to_camframe(const tf::Transform &cam_tf, const tf::Transform &obj_tf) {
-        auto full_tf = this->get_tf_in_camera_frame(cam_tf, obj_tf);
-        auto out_cloud = std::make_shared<pcl::PointCloud<pcl::PointXYZRGB>>();
-        pcl_ros::transformPointCloud(*(this->obj_cloud), *(out_cloud), full_tf);
-        return out_cloud;
+    const PointBuffer &get_model() const {
+        return this->model;
+    }
+
+    const PointBVH &get_bvh() const {
+        return this->bvh;
+    }
+
+    const PointBuffer &get_mesh_vertices() const {
+        return this->mesh_vertices;
+    }
+
+    const std::vector<uint32_t> &get_triangles() const {
+        return this->triangles;
     }
 
     tf::Transform get_tf_in_camera_frame(const tf::Transform &cam_tf, const tf::Transform &obj_tf) {
@@ -5,9 +5,13 @@
 #include <iomanip>
 #include <iostream>
 #include <unordered_map>
+#include <atomic>
+#include <mutex>
+#include <thread>
 
 #include <ros/ros.h>
 #include <ros/package.h>
+#include <ros/callback_queue.h>
 #include <pcl_ros/point_cloud.h>
 #include <pcl_ros/transforms.h>
 #include <pcl/point_types.h>
@@ -41,7 +45,10 @@
 
 #include "object.h"
 #include "event_vis.h"
+#include "event_writer.h"
+#include "event_arena.h"
 #include "running_average.h"
+#include "spsc_ring.h"
 
 std::vector<ViObject*> objects;
 StaticObject *room_scan;
@@ -50,7 +57,7 @@ PoseManager cam_pos_manager;
 vicon::Subject last_cam_pos;
 static float cam_visibility = 0.0;
 static unsigned long int numreceived = 0;
-static unsigned long int epacks_received = 0;
+static std::atomic<unsigned long int> epacks_received(0);
 ros::Time first_event_msg_ts;
 ros::Time last_event_msg_ts;
 ros::Time first_cam_pos_ts;
@@ -82,9 +89,35 @@ std::string dataset_folder;
 #define TIME_WIDTH 0.02
 static ull start_timestamp = 0;
 CircularArray<Event, EVENT_WIDTH, FROM_SEC(TIME_WIDTH)> ev_buffer;
-std::list<Event> all_events;
+EventArena all_events;
 std::list<std::pair<cv::Mat, double>> all_depthmaps;
 
+// Events as they come from the driver, timestamps relative to start_timestamp.
+// Every packet is followed by a PACKET_END entry with the message stamp in 'ts'
+struct RawEvent {
+    static constexpr uint8_t PACKET_END = 0xff;
+
+    ull ts;
+    uint16_t x, y;
+    uint8_t polarity;
+};
+
+// event_cb only copies the events into the ring. event_consumer() moves them to
+// ev_buffer / all_events, runs the pose callbacks (they are subscribed on
+// pose_queue) and does all the rendering but the GUI-triggered one, so no ROS
+// callback ever waits. Everything the consumer touches (event buffers, poses,
+// objects, vis_img) is guarded by state_lock, against the GUI loop
+static std::unique_ptr<SpscRing<RawEvent>> event_ring;
+static ros::CallbackQueue pose_queue;
+static std::atomic<bool> event_consumer_running(false);
+static std::atomic<unsigned long int> events_dropped(0);
+static size_t event_ring_max_depth = 0;
+static std::mutex state_lock;
+
+// Timestamp of the last event of the last packet the consumer has fully drained;
+// pairs with last_event_msg_ts
+static ull last_packet_event_ts = 0;
+
 
 void process_camera(tf::Transform to_camcenter);
 tf::Transform world2camcenter(const vicon::Subject& p) {
@@ -119,21 +152,61 @@ void event_cb(const dvs_msgs::EventArray::ConstPtr& msg) {
         std::cout << "The first event timestamp: " << _green(std::to_string(start_timestamp)) << std::endl;
     }
 
+    if (msg->events.size() == 0)
+        return;
+
+    unsigned long int dropped = 0;
     for (uint i = 0; i < msg->events.size(); ++i) {
-        ull time = msg->events[i].ts.toNSec() - start_timestamp;
-        Event e(msg->events[i].y, msg->events[i].x, time, (msg->events[i].polarity ? 1 : 0));
-        ev_buffer.push_back(e);
-        all_events.push_back(e);
+        RawEvent e = {msg->events[i].ts.toNSec() - start_timestamp, msg->events[i].x, msg->events[i].y,
+                      uint8_t(msg->events[i].polarity ? 1 : 0)};
+        if (!event_ring->push(e)) dropped ++;
     }
+    event_ring->push({msg->header.stamp.toNSec(), 0, 0, RawEvent::PACKET_END});
 
-    if (msg->events.size() > 0) {
-        epacks_received ++;
-        last_event_msg_ts = msg->header.stamp;
-    }
+    if (dropped > 0 && events_dropped.fetch_add(dropped) == 0)
+        std::cout << _yellow("Warning! ") << "Event queue is full, dropping events" << std::endl;
 
-    if (mode == "CALIBRATION") {
-        auto tf_to_camcenter = world2camcenter(last_cam_pos);
-        process_camera(tf_to_camcenter);
+    epacks_received ++;
+}
+
+
+// Drains the event ring and runs the pose callbacks queued since the last
+// batch, so a pose is processed with the events received before it; in the
+// CALIBRATION mode the frame is re-rendered once per drained batch rather than
+// once per event packet
+void event_consumer() {
+    static constexpr size_t BATCH = 1 << 16;
+    std::vector<RawEvent> batch(BATCH);
+    ull last_event_ts = 0;
+    while (event_consumer_running) {
+        size_t depth = event_ring->size();
+        size_t n = event_ring->pop(batch.data(), batch.size());
+        if (n == 0 && pose_queue.isEmpty()) {
+            std::this_thread::sleep_for(std::chrono::microseconds(500));
+            continue;
+        }
+
+        std::lock_guard<std::mutex> guard(state_lock);
+        event_ring_max_depth = std::max(event_ring_max_depth, depth);
+        for (size_t i = 0; i < n; ++i) {
+            if (batch[i].polarity == RawEvent::PACKET_END) {
+                last_event_msg_ts.fromNSec(batch[i].ts);
+                last_packet_event_ts = last_event_ts;
+                continue;
+            }
+
+            Event e(batch[i].y, batch[i].x, batch[i].ts, batch[i].polarity);
+            ev_buffer.push_back(e);
+            all_events.push_back(e);
+            last_event_ts = batch[i].ts;
+        }
+
+        pose_queue.callAvailable();
+
+        if (n > 0 && mode == "CALIBRATION" && event_ring->size() < BATCH) {
+            auto tf_to_camcenter = world2camcenter(last_cam_pos);
+            process_camera(tf_to_camcenter);
+        }
     }
 }
 
@@ -302,13 +375,14 @@ void process_camera(tf::Transform to_camcenter) {
         }
     }
 
-    if (epacks_received == 0)
+    if (epacks_received == 0 || all_events.size() == 0 || last_event_msg_ts == ros::Time(0))
         return;
 
     // Room scan transformation
     room_scan->update_camera_pose(to_camcenter);
 
-    double et_sec = double(all_events.back().timestamp / 1000) / 1000000.0;
+    // The event and the message stamp of the same packet, whatever is still queued
+    double et_sec = double(last_packet_event_ts / 1000) / 1000000.0;
     double image_ts = et_sec + (last_cam_pos.header.stamp - last_event_msg_ts).toSec();
 
     cv::Mat projected(RES_X, RES_Y, CV_32FC3, cv::Scalar(0, 0, 0));
@@ -343,6 +417,7 @@ void process_camera(tf::Transform to_camcenter) {
 }
 
 
+// Runs on the event consumer thread, with state_lock held (see pose_queue)
 void camera_pos_cb(const vicon::Subject& subject) {
     auto tf_to_camcenter = world2camcenter(subject);
     cam_pos_manager.push_back(ViObject::tf2subject(tf_to_camcenter), ViObject::tf2subject(tf_to_camcenter));
@@ -465,25 +540,16 @@ void save_data(std::string dir) {
     cam_file.close();
     std::cout << "GT written....\n";
 
-    std::string efname = dir + "/events.txt";
-    std::ofstream event_file(efname, std::ofstream::out);
-    i = 0;
-    std::stringstream ss;
-    for (auto &e : all_events) {
-        if (i % 100000 == 0) {
-            std::cout << "Formatting " << i << " / " << all_events.size() <<  std::endl;
-        }
+    // Event timestamps are written with microsecond resolution
+    std::cout << "Writing events.txt" <<  std::endl;
+    EventTxtWriter txt_writer(dir + "/events.txt", 1000);
+    all_events.for_each_block([&txt_writer](EventStore &events) {txt_writer.append(events); });
+    txt_writer.close();
 
-        ss << std::fixed << std::setprecision(9)
-           << double(e.timestamp / 1000) / 1000000.0
-           << " " << e.fr_y << " " << e.fr_x
-           << " " << int(e.polarity) << std::endl;
-        i ++;
-    }
-
-    std::cout << "Saving on disk" <<  std::endl;
-    event_file << ss.str();
-    event_file.close();
+    std::cout << "Writing events.bin" <<  std::endl;
+    EventBinWriter bin_writer(dir + "/events.bin", all_events.size());
+    all_events.for_each_block([&bin_writer](EventStore &events) {bin_writer.append(events); });
+    bin_writer.close();
     std::cout << "Events written... Done\n";
 }
 
@@ -597,9 +663,13 @@ int main (int argc, char** argv) {
     vis_pub = nh.advertise<visualization_msgs::MarkerArray>("/ev_imo/markers", 0);
     vis_pub_range = nh.advertise<sensor_msgs::Range>("/ev_imo/markers_range",  0);
 
+    // Poses are handled by the event consumer, see event_consumer()
+    ros::NodeHandle pose_nh;
+    pose_nh.setCallbackQueue(&pose_queue);
+
     // One of the cameras
-    ros::Subscriber cam_sub_1 = nh.subscribe("/vicon/DVS346", 0, camera_pos_cb);
-    ros::Subscriber cam_sub_2 = nh.subscribe("/vicon/DAVIS240C", 0, camera_pos_cb);
+    ros::Subscriber cam_sub_1 = pose_nh.subscribe("/vicon/DVS346", 0, camera_pos_cb);
+    ros::Subscriber cam_sub_2 = pose_nh.subscribe("/vicon/DAVIS240C", 0, camera_pos_cb);
 
     ros::Subscriber event_sub = nh.subscribe("/dvs/events", 0, event_cb);
     image_pub = it_.advertise("/ev_imo/depth_raw", 1);
@@ -608,6 +678,16 @@ int main (int argc, char** argv) {
     if (!nh.getParam("event_imo_online/fps", FPS)) FPS = 40;
     if (!nh.getParam("event_imo_online/smoothing", traj_smoothing)) traj_smoothing = 1;
 
+    // Events above this amount of memory are moved to a temporary file
+    int event_memory_mb = 2048;
+    if (!nh.getParam("event_imo_online/event_memory_mb", event_memory_mb)) event_memory_mb = 2048;
+    all_events.set_memory_cap(size_t(std::max(event_memory_mb, 0)) << 20);
+
+    // Events buffered between the ROS callback and the processing thread
+    int event_queue_size = 1 << 21;
+    if (!nh.getParam("event_imo_online/event_queue_size", event_queue_size)) event_queue_size = 1 << 21;
+    event_ring.reset(new SpscRing<RawEvent>(size_t(std::max(event_queue_size, 1))));
+
     std::string path_to_self = ros::package::getPath("evimo");
 
     last_cam_pos.header.stamp = ros::Time(0);
@@ -628,17 +708,17 @@ int main (int argc, char** argv) {
     if (!parse_config(dataset_folder + "/config.txt", active_objects))
         return -1;
 
-    ViObject obj1(nh, path_to_self + "/objects/toy_car", 1);
+    ViObject obj1(pose_nh, path_to_self + "/objects/toy_car", 1);
     if (active_objects[0] == '+') {
         objects.push_back(&obj1);
     }
 
-    ViObject obj2(nh, path_to_self + "/objects/toy_plane", 2);
+    ViObject obj2(pose_nh, path_to_self + "/objects/toy_plane", 2);
     if (active_objects[1] == '+') {
         objects.push_back(&obj2);
     }
 
-    ViObject obj3(nh, path_to_self + "/objects/cup", 3);
+    ViObject obj3(pose_nh, path_to_self + "/objects/cup", 3);
     if (active_objects[2] == '+') {
         objects.push_back(&obj3);
     }
@@ -662,15 +742,23 @@ int main (int argc, char** argv) {
 
     vis_img = EventFile::color_time_img(&ev_buffer, 1);
 
-    // Spin
-    if (mode == "DEMO") {
-        ros::spin();
+    if (mode != "DEMO" && mode != "CALIBRATION" && mode != "GENERATION") {
+        std::cout << "Unsupported mode of operation: " << mode << std::endl;
         ros::shutdown();
         return 0;
     }
 
-    if (mode != "CALIBRATION" && mode != "GENERATION") {
-        std::cout << "Unsupported mode of operation: " << mode << std::endl;
+    event_consumer_running = true;
+    std::thread consumer(event_consumer);
+    auto stop_consumer = [&consumer]() {
+        event_consumer_running = false;
+        consumer.join();
+    };
+
+    // Spin
+    if (mode == "DEMO") {
+        ros::spin();
+        stop_consumer();
         ros::shutdown();
         return 0;
     }
@@ -704,10 +792,18 @@ int main (int argc, char** argv) {
     while (ros::ok() && (code != 27)) {
         // ====== CV GUI ======
         float scale = (float(value_br) / float(maxval) * 2 + 0.5);
-        cv::imshow(cv_window_name, vis_img * scale);
-        cv::imshow(cv_window_name_bg, undistort(vis_img) * scale);
+        cv::Mat shown_img;
+        {
+            std::lock_guard<std::mutex> guard(state_lock);
+            shown_img = vis_img.clone();
+        }
+        cv::imshow(cv_window_name, shown_img * scale);
+        cv::imshow(cv_window_name_bg, undistort(shown_img) * scale);
         code = cv::waitKey(1);
 
+        // The trackbars and the key handling below only run with the event consumer paused
+        std::unique_lock<std::mutex> guard(state_lock);
+
         if (code == 99) { // 'c'
             cv::setTrackbarPos("R", cv_window_name, maxval / 2);
             cv::setTrackbarPos("P", cv_window_name, maxval / 2);
@@ -777,12 +873,14 @@ int main (int argc, char** argv) {
             std::cout << "Last camera pos ts: " << last_cam_pos.header.stamp - ros_start_time << std::endl;
             std::cout << "Last event pack ts: " << last_event_msg_ts - ros_start_time << std::endl;
 
-            double et_sec = double(all_events.back().timestamp / 1000) / 1000000.0;
-            std::cout << "Last event ts: " << et_sec << "\t|\t" << all_events.back().timestamp << std::endl;
+            double et_sec = double(last_packet_event_ts / 1000) / 1000000.0;
+            std::cout << "Last event ts: " << et_sec << "\t|\t" << last_packet_event_ts << std::endl;
             std::cout << "Event pack - event: " << (last_event_msg_ts - ros_start_time).toSec() - et_sec << std::endl;
             std::cout << "Cam pos - event: " << (last_cam_pos.header.stamp - ros_start_time).toSec() - et_sec << std::endl;
             std::cout << "Image timestamp: " << et_sec + (last_cam_pos.header.stamp - last_event_msg_ts).toSec() << std::endl; 
-            std::cout << "Gt frames: " << all_depthmaps.size() << "\t" << "events: " << all_events.size() << std::endl << std::endl;
+            std::cout << "Gt frames: " << all_depthmaps.size() << "\t" << "events: " << all_events.size() << std::endl;
+            std::cout << "Event queue: " << event_ring->size() << " / " << event_ring->capacity()
+                      << " (max " << event_ring_max_depth << "), dropped: " << events_dropped << std::endl << std::endl;
             std::cout << "Transforms:" << std::endl;
             std::cout << "Vicon -> Camcenter (X Y Z R P Y):" << std::endl;
             std::cout << "\t" << tx << "\t" << ty << "\t" << tz << "\t" << rr << "\t" << rp << "\t" << ry << std::endl;
@@ -795,9 +893,11 @@ int main (int argc, char** argv) {
 
         // ====================
 
+        guard.unlock();
         ros::spinOnce();
     }
 
+    stop_consumer();
     ros::shutdown();
     return 0;
 };
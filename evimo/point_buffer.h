@@ -0,0 +1,67 @@
+#ifndef POINT_BUFFER_H
+#define POINT_BUFFER_H
+
+#include <new>
+#include <vector>
+
+
+template <class T, size_t A> struct AlignedAllocator {
+    typedef T value_type;
+    template <class U> struct rebind {typedef AlignedAllocator<U, A> other; };
+
+    AlignedAllocator () = default;
+    template <class U> AlignedAllocator (const AlignedAllocator<U, A>&) {}
+
+    T *allocate (size_t n) {return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(A))); }
+    void deallocate (T *p, size_t) {::operator delete(p, std::align_val_t(A)); }
+
+    template <class U> bool operator == (const AlignedAllocator<U, A>&) const {return true; }
+    template <class U> bool operator != (const AlignedAllocator<U, A>&) const {return false; }
+};
+
+
+// Point coordinates as separate 32-byte aligned x / y / z float arrays
+class PointBuffer {
+public:
+    typedef std::vector<float, AlignedAllocator<float, 32>> Column;
+
+protected:
+    Column x_col, y_col, z_col;
+    size_t current_size;
+
+public:
+    PointBuffer () : current_size(0) {}
+
+    inline size_t size () const {return this->current_size; }
+
+    void resize (size_t n) {
+        if (n > this->x_col.size()) {
+            this->x_col.resize(n);
+            this->y_col.resize(n);
+            this->z_col.resize(n);
+        }
+        this->current_size = n;
+    }
+
+    // Anything iterable with x, y, z members, e.g. a pcl::PointCloud
+    template <class C> void assign (const C &cloud) {
+        this->resize(cloud.size());
+        size_t i = 0;
+        for (auto &p : cloud) {
+            this->x_col[i] = p.x;
+            this->y_col[i] = p.y;
+            this->z_col[i] = p.z;
+            ++i;
+        }
+    }
+
+    inline float *x () {return this->x_col.data(); }
+    inline float *y () {return this->y_col.data(); }
+    inline float *z () {return this->z_col.data(); }
+    inline const float *x () const {return this->x_col.data(); }
+    inline const float *y () const {return this->y_col.data(); }
+    inline const float *z () const {return this->z_col.data(); }
+};
+
+
+#endif // POINT_BUFFER_H
@@ -0,0 +1,273 @@
+#ifndef PROJECTION_H
+#define PROJECTION_H
+
+#include <cmath>
+#include <limits>
+#include <cstddef>
+#include <algorithm>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define EVIMO_PROJECTION_AVX2
+#include <immintrin.h>
+#endif
+
+
+// Pinhole projection with radial distortion, over points stored as separate
+// x / y / z arrays. The batched path projects 8 points per iteration with AVX2
+// when the CPU supports it (checked at run time); it performs the same
+// operations in the same precision as the scalar code, so the pixels are identical:
+// the distortion numerator and the division are evaluated in double, everything
+// else in float, and pixel coordinates are truncated to int. This relies on
+// the compiler not fusing multiply-adds (-ffp-contract=off, see CMakeLists.txt)
+class Projector {
+protected:
+    float fx, fy, cx, cy, k1, k2, k3, k4;
+
+    // Smallest float z for which (double)z >= 0.00001, so the float
+    // comparison matches the scalar code
+    float z_min;
+
+public:
+    Projector(float fx_, float fy_, float cx_, float cy_, float k1_, float k2_, float k3_, float k4_)
+        : fx(fx_), fy(fy_), cx(cx_), cy(cy_), k1(k1_), k2(k2_), k3(k3_), k4(k4_) {
+        this->z_min = 0.00001f;
+        if (double(this->z_min) < 0.00001) this->z_min = std::nextafter(this->z_min, 1.0f);
+    }
+
+    // u = v = -1 for points behind the camera
+    inline void project(float x, float y, float z, int &u, int &v) const {
+        u = -1; v = -1;
+        if (z < 0.00001)
+            return;
+
+        float x_ = x / z;
+        float y_ = y / z;
+
+        float r2 = x_ * x_ + y_ * y_;
+        float r4 = r2 * r2;
+        float r6 = r2 * r2 * r2;
+        float dist = (1.0 + this->k1 * r2 + this->k2 * r4 +
+                            this->k3 * r6) / (1 + this->k4 * r2);
+        float x__ = x_ * dist;
+        float y__ = y_ * dist;
+
+        u = this->fx * x__ + this->cx;
+        v = this->fy * y__ + this->cy;
+    }
+
+    // project() without truncating the pixel coordinates, for the mesh rasterizer:
+    // pixel (u, v) covers [u, u + 1) x [v, v + 1); false for points behind the camera
+    inline bool project_subpixel(float x, float y, float z, float &u, float &v) const {
+        if (z < 0.00001)
+            return false;
+
+        float x_ = x / z;
+        float y_ = y / z;
+
+        float r2 = x_ * x_ + y_ * y_;
+        float r4 = r2 * r2;
+        float r6 = r2 * r2 * r2;
+        float dist = (1.0 + this->k1 * r2 + this->k2 * r4 +
+                            this->k3 * r6) / (1 + this->k4 * r2);
+
+        u = this->fx * (x_ * dist) + this->cx;
+        v = this->fy * (y_ * dist) + this->cy;
+        return true;
+    }
+
+    // Inverse of project_subpixel for z = 1: the normalized, undistorted (x, y)
+    // of the continuous pixel (u, v), by fixed-point iteration on the radial
+    // model; false if it does not converge
+    bool unproject(float u, float v, float &x, float &y) const {
+        double xd = (u - this->cx) / this->fx, yd = (v - this->cy) / this->fy;
+        double x_ = xd, y_ = yd;
+        for (int i = 0; i < 50; ++i) {
+            double r2 = x_ * x_ + y_ * y_;
+            double dist = (1.0 + this->k1 * r2 + this->k2 * r2 * r2 + this->k3 * r2 * r2 * r2) / (1 + this->k4 * r2);
+            if (!(dist > 0)) return false;
+            double nx = xd / dist, ny = yd / dist;
+            bool done = std::fabs(nx - x_) < 1e-9 && std::fabs(ny - y_) < 1e-9;
+            x_ = nx; y_ = ny;
+            if (done) break;
+        }
+
+        float u_, v_;
+        if (!this->project_subpixel(x_, y_, 1.0f, u_, v_) || std::fabs(u_ - u) > 0.01 || std::fabs(v_ - v) > 0.01)
+            return false;
+        x = x_; y = y_;
+        return true;
+    }
+
+    // The same camera without the distortion, for z = 1
+    inline void project_pinhole(float x, float y, float &u, float &v) const {
+        u = this->fx * x + this->cx;
+        v = this->fy * y + this->cy;
+    }
+
+    inline void unproject_pinhole(float u, float v, float &x, float &y) const {
+        x = (u - this->cx) / this->fx;
+        y = (v - this->cy) / this->fy;
+    }
+
+    bool operator == (const Projector &o) const {
+        return this->fx == o.fx && this->fy == o.fy && this->cx == o.cx && this->cy == o.cy &&
+               this->k1 == o.k1 && this->k2 == o.k2 && this->k3 == o.k3 && this->k4 == o.k4;
+    }
+
+    // A normalized radius r = sqrt(x^2 + y^2) / z beyond which no point can land
+    // in a rows x cols image, with a margin; inf if the distortion model does not
+    // allow to tell. The distorted radius r * dist(r^2) is sampled up to R_MAX
+    // (about 89.4 degrees off-axis) and has to keep growing past it
+    float cull_radius(int rows, int cols) const {
+        static constexpr double R_MAX = 100.0;
+        static constexpr int N_SAMPLES = 20000;
+        const double inf = std::numeric_limits<float>::infinity();
+
+        // u = (int)(fx * x * dist + cx) is in [0, rows) only if |fx * x * dist| < max(cx + 1, rows - cx)
+        double wx = (std::max(double(this->cx) + 1, rows - double(this->cx)) + 1) / std::fabs(this->fx);
+        double wy = (std::max(double(this->cy) + 1, cols - double(this->cy)) + 1) / std::fabs(this->fy);
+        double g_max = std::sqrt(wx * wx + wy * wy);
+
+        auto g = [this](double r) {
+            double r2 = r * r;
+            double dist = (1.0 + this->k1 * r2 + this->k2 * r2 * r2 + this->k3 * r2 * r2 * r2) / (1 + this->k4 * r2);
+            return r * std::fabs(dist);
+        };
+
+        double r_last = 0;
+        for (int i = 1; i <= N_SAMPLES; ++i) {
+            double r = R_MAX * i / N_SAMPLES;
+            if (!(g(r) > g_max * 1.01)) r_last = r;
+        }
+
+        // Degree of the distorted radius as r -> inf
+        int num_deg = (this->k3 != 0) ? 6 : (this->k2 != 0) ? 4 : (this->k1 != 0) ? 2 : 0;
+        int den_deg = (this->k4 != 0) ? 2 : 0;
+        if (r_last >= R_MAX || 1 + num_deg - den_deg <= 0 || !(g(R_MAX * 2) > g(R_MAX)))
+            return inf;
+        return (r_last + R_MAX / N_SAMPLES) * 1.01;
+    }
+
+    void project(const float *x, const float *y, const float *z, size_t n, int *u, int *v) const {
+        size_t i = 0;
+#ifdef EVIMO_PROJECTION_AVX2
+        if (Projector::has_avx2()) i = this->project_avx2(x, y, z, n, u, v);
+#endif
+        for (; i < n; ++i)
+            this->project(x[i], y[i], z[i], u[i], v[i]);
+    }
+
+    // Transform model points with the row-major 3x4 matrix 'm' and project them,
+    // in one pass; the camera-frame z goes to 'depth'. The transform is evaluated
+    // as m[0] * x + m[1] * y + m[2] * z + m[3], in float
+    inline void transform_project(float x, float y, float z, const float *m, int &u, int &v, float &depth) const {
+        float cx_ = m[0] * x + m[1] * y + m[2]  * z + m[3];
+        float cy_ = m[4] * x + m[5] * y + m[6]  * z + m[7];
+        float cz_ = m[8] * x + m[9] * y + m[10] * z + m[11];
+        depth = cz_;
+        this->project(cx_, cy_, cz_, u, v);
+    }
+
+    void transform_project(const float *x, const float *y, const float *z, size_t n, const float *m,
+                           int *u, int *v, float *depth) const {
+        size_t i = 0;
+#ifdef EVIMO_PROJECTION_AVX2
+        if (Projector::has_avx2()) i = this->transform_project_avx2(x, y, z, n, m, u, v, depth);
+#endif
+        for (; i < n; ++i)
+            this->transform_project(x[i], y[i], z[i], m, u[i], v[i], depth[i]);
+    }
+
+#ifdef EVIMO_PROJECTION_AVX2
+    static bool has_avx2() {
+        static const bool supported = __builtin_cpu_supports("avx2");
+        return supported;
+    }
+
+protected:
+    struct Constants {
+        __m256 fx, fy, cx, cy, k1, k2, k3, k4, one, z_min;
+    };
+
+    __attribute__((target("avx2")))
+    Constants avx2_constants() const {
+        return {_mm256_set1_ps(this->fx), _mm256_set1_ps(this->fy), _mm256_set1_ps(this->cx),
+                _mm256_set1_ps(this->cy), _mm256_set1_ps(this->k1), _mm256_set1_ps(this->k2),
+                _mm256_set1_ps(this->k3), _mm256_set1_ps(this->k4), _mm256_set1_ps(1.0f),
+                _mm256_set1_ps(this->z_min)};
+    }
+
+    // The scalar project() for 8 points
+    __attribute__((target("avx2"), always_inline))
+    static inline void project8(const Constants &k, __m256 X, __m256 Y, __m256 Z, int *u, int *v) {
+        __m256 x_ = _mm256_div_ps(X, Z);
+        __m256 y_ = _mm256_div_ps(Y, Z);
+
+        __m256 r2 = _mm256_add_ps(_mm256_mul_ps(x_, x_), _mm256_mul_ps(y_, y_));
+        __m256 r4 = _mm256_mul_ps(r2, r2);
+        __m256 r6 = _mm256_mul_ps(r4, r2);
+        __m256 a = _mm256_mul_ps(k.k1, r2);
+        __m256 b = _mm256_mul_ps(k.k2, r4);
+        __m256 c = _mm256_mul_ps(k.k3, r6);
+        __m256 den = _mm256_add_ps(k.one, _mm256_mul_ps(k.k4, r2));
+
+        __m128 dist_h[2];
+        for (int h = 0; h < 2; ++h) {
+            __m128 a_h = h ? _mm256_extractf128_ps(a, 1) : _mm256_castps256_ps128(a);
+            __m128 b_h = h ? _mm256_extractf128_ps(b, 1) : _mm256_castps256_ps128(b);
+            __m128 c_h = h ? _mm256_extractf128_ps(c, 1) : _mm256_castps256_ps128(c);
+            __m128 d_h = h ? _mm256_extractf128_ps(den, 1) : _mm256_castps256_ps128(den);
+
+            __m256d num = _mm256_add_pd(_mm256_set1_pd(1.0), _mm256_cvtps_pd(a_h));
+            num = _mm256_add_pd(num, _mm256_cvtps_pd(b_h));
+            num = _mm256_add_pd(num, _mm256_cvtps_pd(c_h));
+            dist_h[h] = _mm256_cvtpd_ps(_mm256_div_pd(num, _mm256_cvtps_pd(d_h)));
+        }
+        __m256 dist = _mm256_insertf128_ps(_mm256_castps128_ps256(dist_h[0]), dist_h[1], 1);
+
+        __m256 U = _mm256_add_ps(_mm256_mul_ps(k.fx, _mm256_mul_ps(x_, dist)), k.cx);
+        __m256 V = _mm256_add_ps(_mm256_mul_ps(k.fy, _mm256_mul_ps(y_, dist)), k.cy);
+
+        __m256i behind = _mm256_castps_si256(_mm256_cmp_ps(Z, k.z_min, _CMP_LT_OQ));
+        __m256i invalid = _mm256_set1_epi32(-1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(u), _mm256_blendv_epi8(_mm256_cvttps_epi32(U), invalid, behind));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(v), _mm256_blendv_epi8(_mm256_cvttps_epi32(V), invalid, behind));
+    }
+
+    // Both return the number of points processed, a multiple of 8
+    __attribute__((target("avx2")))
+    size_t project_avx2(const float *x, const float *y, const float *z, size_t n, int *u, int *v) const {
+        const Constants k = this->avx2_constants();
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+            project8(k, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), _mm256_loadu_ps(z + i), u + i, v + i);
+        return i;
+    }
+
+    __attribute__((target("avx2")))
+    size_t transform_project_avx2(const float *x, const float *y, const float *z, size_t n, const float *m,
+                                  int *u, int *v, float *depth) const {
+        const Constants k = this->avx2_constants();
+        __m256 M[12];
+        for (int j = 0; j < 12; ++j) M[j] = _mm256_set1_ps(m[j]);
+
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m256 X = _mm256_loadu_ps(x + i), Y = _mm256_loadu_ps(y + i), Z = _mm256_loadu_ps(z + i);
+            __m256 C[3];
+            for (int r = 0; r < 3; ++r) {
+                C[r] = _mm256_add_ps(_mm256_mul_ps(M[4 * r], X), _mm256_mul_ps(M[4 * r + 1], Y));
+                C[r] = _mm256_add_ps(C[r], _mm256_mul_ps(M[4 * r + 2], Z));
+                C[r] = _mm256_add_ps(C[r], M[4 * r + 3]);
+            }
+
+            _mm256_storeu_ps(depth + i, C[2]);
+            project8(k, C[0], C[1], C[2], u + i, v + i);
+        }
+        return i;
+    }
+#endif
+};
+
+
+#endif // PROJECTION_H
@@ -0,0 +1,158 @@
+#ifndef RASTERIZER_H
+#define RASTERIZER_H
+
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#include <opencv2/core/core.hpp>
+
+
+// Depth / object id z-buffer for rectangular splats, resolved on several
+// threads: the splats are recorded in order, binned into screen tiles, and the
+// tiles are drawn in parallel. Within a tile the splats are drawn in the order
+// they were added, so the result is the same as drawing them one by one: the
+// nearest depth wins, and of two equal depths the first one stays
+class TiledRasterizer {
+public:
+    static constexpr int TILE = 64;
+
+    // Inclusive pixel bounds, in image (row, col) coordinates
+    struct Splat {
+        int r_lo, r_hi, c_lo, c_hi;
+        float rng;
+        uint8_t oid;
+    };
+
+protected:
+    std::vector<Splat> splats;
+
+public:
+    inline void add (int r_lo, int r_hi, int c_lo, int c_hi, float rng, uint8_t oid) {
+        this->splats.push_back({r_lo, r_hi, c_lo, c_hi, rng, oid});
+    }
+
+    inline size_t size () const {return this->splats.size(); }
+    void clear () {this->splats.clear(); }
+
+    // The depth-test used by DatasetFrame; 'depth' is CV_32F, 'mask' is CV_8U
+    static inline void draw (cv::Mat &depth, cv::Mat &mask, int r_lo, int r_hi, int c_lo, int c_hi,
+                             float rng, uint8_t oid) {
+        for (int r = r_lo; r <= r_hi; ++r) {
+            float *d = depth.ptr<float>(r);
+            uint8_t *m = mask.ptr<uint8_t>(r);
+            for (int c = c_lo; c <= c_hi; ++c) {
+                float base_rng = d[c];
+                if (base_rng > rng || base_rng < 0.001) {
+                    d[c] = rng;
+                    m[c] = oid;
+                }
+            }
+        }
+    }
+
+    // Scanline fill of a triangle with the same depth-test; the vertices are
+    // {row, col, depth} in continuous image coordinates (pixel centers at +0.5).
+    // Depth is interpolated linearly in 1 / depth, i.e. perspective-correct
+    static void draw_triangle (cv::Mat &depth, cv::Mat &mask, const float *a, const float *b, const float *c,
+                               uint8_t oid) {
+        // 1 / depth = A * row + B * col + C
+        double e1r = b[0] - a[0], e1c = b[1] - a[1], e2r = c[0] - a[0], e2c = c[1] - a[1];
+        double det = e1r * e2c - e2r * e1c;
+        if (std::fabs(det) < 1e-12)
+            return;
+
+        double w1 = 1.0 / b[2] - 1.0 / a[2], w2 = 1.0 / c[2] - 1.0 / a[2];
+        double A = (w1 * e2c - w2 * e1c) / det;
+        double B = (w2 * e1r - w1 * e2r) / det;
+        double C = 1.0 / a[2] - A * a[0] - B * a[1];
+
+        const float *v[3] = {a, b, c};
+        float r_min = std::min({a[0], b[0], c[0]}), r_max = std::max({a[0], b[0], c[0]});
+        int r_lo = int(std::ceil(std::max(r_min, 0.0f) - 0.5f));
+        int r_hi = int(std::floor(std::min(r_max, float(depth.rows)) - 0.5f));
+
+        for (int r = r_lo; r <= r_hi; ++r) {
+            // The span of the row center line inside the triangle
+            double y = r + 0.5, x_lo = std::numeric_limits<double>::max(), x_hi = std::numeric_limits<double>::lowest();
+            for (int k = 0; k < 3; ++k) {
+                const float *p = v[k], *q = v[(k + 1) % 3];
+                if ((y < p[0] && y < q[0]) || (y > p[0] && y > q[0]))
+                    continue;
+                double x = (p[0] == q[0]) ? std::min(p[1], q[1]) : p[1] + (y - p[0]) * (q[1] - p[1]) / (q[0] - p[0]);
+                double x_ = (p[0] == q[0]) ? std::max(p[1], q[1]) : x;
+                x_lo = std::min(x_lo, x);
+                x_hi = std::max(x_hi, x_);
+            }
+            if (x_lo > x_hi)
+                continue;
+
+            int c_lo = int(std::ceil(std::max(x_lo, 0.0) - 0.5));
+            int c_hi = int(std::floor(std::min(x_hi, double(depth.cols)) - 0.5));
+            float *d = depth.ptr<float>(r);
+            uint8_t *m = mask.ptr<uint8_t>(r);
+            for (int col = c_lo; col <= c_hi; ++col) {
+                float rng = 1.0 / (A * y + B * (col + 0.5) + C);
+                float base_rng = d[col];
+                if (base_rng > rng || base_rng < 0.001) {
+                    d[col] = rng;
+                    m[col] = oid;
+                }
+            }
+        }
+    }
+
+    void resolve (cv::Mat &depth, cv::Mat &mask, size_t n_threads = 0) {
+        if (n_threads == 0) n_threads = std::max(std::thread::hardware_concurrency(), 1u);
+        if (n_threads == 1 || this->splats.size() < 1024) {
+            for (auto &s : this->splats)
+                draw(depth, mask, s.r_lo, s.r_hi, s.c_lo, s.c_hi, s.rng, s.oid);
+            return;
+        }
+
+        int tiles_r = (depth.rows + TILE - 1) / TILE, tiles_c = (depth.cols + TILE - 1) / TILE;
+        size_t n_tiles = tiles_r * tiles_c;
+
+        // Every thread bins a contiguous range of splats, so reading the bins
+        // of one tile in thread order keeps the order the splats were added in
+        std::vector<std::vector<std::vector<uint32_t>>> bins(n_threads, std::vector<std::vector<uint32_t>>(n_tiles));
+        auto bin = [&](size_t t) {
+            size_t first = this->splats.size() * t / n_threads, last = this->splats.size() * (t + 1) / n_threads;
+            for (size_t i = first; i < last; ++i) {
+                auto &s = this->splats[i];
+                for (int tr = s.r_lo / TILE; tr <= s.r_hi / TILE; ++tr)
+                    for (int tc = s.c_lo / TILE; tc <= s.c_hi / TILE; ++tc)
+                        bins[t][tr * tiles_c + tc].push_back(i);
+            }
+        };
+
+        std::atomic<size_t> next_tile(0);
+        auto draw_tiles = [&]() {
+            for (size_t k = next_tile++; k < n_tiles; k = next_tile++) {
+                int r0 = int(k / tiles_c) * TILE, c0 = int(k % tiles_c) * TILE;
+                int r1 = std::min(r0 + TILE, depth.rows) - 1, c1 = std::min(c0 + TILE, depth.cols) - 1;
+                for (auto &b : bins) {
+                    for (auto i : b[k]) {
+                        auto &s = this->splats[i];
+                        draw(depth, mask, std::max(s.r_lo, r0), std::min(s.r_hi, r1),
+                             std::max(s.c_lo, c0), std::min(s.c_hi, c1), s.rng, s.oid);
+                    }
+                }
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < n_threads; ++t) threads.emplace_back(bin, t);
+        for (auto &t : threads) t.join();
+
+        threads.clear();
+        for (size_t t = 0; t < n_threads; ++t) threads.emplace_back(draw_tiles);
+        for (auto &t : threads) t.join();
+    }
+};
+
+
+#endif // RASTERIZER_H
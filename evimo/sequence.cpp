@@ -0,0 +1,870 @@
+#include <vector>
+#include <valarray>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <tuple>
+#include <type_traits>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <exception>
+#include <future>
+#include <boost/filesystem.hpp>
+
+#include <ros/ros.h>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <pcl_ros/point_cloud.h>
+#include <pcl_ros/transforms.h>
+#include <pcl/point_types.h>
+#include <pcl/common/common_headers.h>
+#include <pcl/common/transforms.h>
+#include <pcl_conversions/pcl_conversions.h>
+
+#include <sensor_msgs/Range.h>
+#include <sensor_msgs/PointCloud.h>
+#include <sensor_msgs/image_encodings.h>
+#include <nav_msgs/Odometry.h>
+#include <message_filters/subscriber.h>
+#include <visualization_msgs/MarkerArray.h>
+#include <image_transport/image_transport.h>
+
+#include <cv_bridge/cv_bridge.h>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/calib3d/calib3d.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+// VICON
+#include <vicon/Subject.h>
+
+// DVS / DAVIS
+#include <dvs_msgs/Event.h>
+#include <dvs_msgs/EventArray.h>
+
+// Local includes
+#include <dataset.h>
+#include <dataset_cache.h>
+#include <bag_reader.h>
+#include <object.h>
+#include <trajectory.h>
+#include <dataset_frame.h>
+#include <annotation_backprojector.h>
+#include <bounded_queue.h>
+#include <sequence.h>
+
+class FrameSequenceVisualizer {
+protected:
+    std::vector<DatasetFrame> *frames;
+    std::shared_ptr<Dataset> dataset;
+    int frame_id;
+
+public:
+    FrameSequenceVisualizer(std::vector<DatasetFrame> &frames)
+        : frame_id(0) {
+        this->frames = &frames;
+        if (frames.empty()) return;
+        this->dataset = frames.front().get_dataset();
+        this->spin();
+    }
+
+    void set_slider(int id) {
+        this->frame_id = id < this->frames->size() - 1 ? id : this->frames->size() - 1;
+        this->frame_id = this->frame_id < 0 ? 0 : this->frame_id;
+        cv::setTrackbarPos("frame", "Frames", this->frame_id);
+        this->dataset->modified = true;
+    }
+
+    void spin() {
+        cv::namedWindow("Frames", cv::WINDOW_NORMAL);
+        cv::createTrackbar("frame", "Frames", &frame_id, frames->size() - 1, on_trackbar, this->dataset.get());
+
+        this->dataset->modified = true;
+        this->dataset->init_GUI();
+        const uint8_t nmodes = 4;
+        uint8_t vis_mode = 0;
+
+        bool enable_3D = false;
+        std::shared_ptr<Backprojector> bp;
+
+        int code = 0; // Key code
+        while (code != 27) {
+            code = cv::waitKey(1);
+            if (bp) bp->maybeViewerSpinOnce();
+
+            this->dataset->handle_keys(code, vis_mode, nmodes);
+
+            if (code == 39) { // '''
+                this->set_slider(this->frame_id + 1);
+            }
+
+            if (code == 59) { // ';'
+                this->set_slider(this->frame_id - 1);
+            }
+
+            /*
+            if (code == 99) { // 'c'
+                this->dataset->modified = true;
+            }
+            */
+
+            if (!this->dataset->modified) continue;
+            this->dataset->modified = false;
+            this->dataset->apply_settings();
+
+            auto &f = this->frames->at(this->frame_id);
+            f.generate(0);
+
+            cv::Mat img;
+            switch (vis_mode) {
+                default:
+                case 0: img = f.get_visualization_mask(true); break;
+                case 1: img = f.get_visualization_mask(false); break;
+                case 2: img = f.get_visualization_depth(true); break;
+                case 3: img = f.get_visualization_event_projection(true); break;
+            }
+
+            cv::imshow("Frames", img);
+
+            if (!bp) {
+                //bp = std::make_shared<Backprojector>(f.get_timestamp(), 5, 10);
+                //bp->initViewer();
+            }
+
+/*
+            if (code == 99) { // 'c'
+                enable_3D = !enable_3D;
+                if (enable_3D) {
+                    bp = std::make_shared<Backprojector>(f.get_timestamp(), 0.1, 100);
+                    bp->initViewer();
+                }
+            }
+            */
+
+            //bp.visualize_parallel();
+
+            if (bp) bp->generate();
+        }
+
+        cv::destroyAllWindows();
+    }
+
+    static void on_trackbar(int, void *dataset) {
+        static_cast<Dataset*>(dataset)->modified = true;
+    }
+};
+
+
+// Messages from one time interval of the bag, see read_bag()
+struct BagPart {
+    DecodedBag data;                   // everything except the events
+    EventArrayBuilder events;          // raw event timestamps, in ns
+    bool has_event_messages = false;
+    ros::Time first_event_ts, last_event_ts;
+    std::vector<std::tuple<uint64_t, ros::Time, ros::Time>> unsorted; // id, previous ts, ts
+};
+
+
+// Decode events, poses and images from the bag; time offsets are applied by the caller.
+// Time intervals of the bag are decoded in parallel and merged in order.
+// With 'stream' set only the poses are decoded: events are left for
+// stream_frames() and images are kept as empty placeholders with their timestamps.
+// Returns the timestamp of the first event
+ros::Time read_bag(std::string bag_name, std::string cam_pose_topic, std::string event_topic, std::string img_topic,
+                   std::map<int, std::string> &obj_pose_topics, bool with_images, size_t n_threads, bool stream,
+                   DecodedBag &out) {
+    rosbag::Bag bag;
+    bag.open(bag_name, rosbag::bagmode::Read);
+    rosbag::View view(bag);
+    std::vector<const rosbag::ConnectionInfo *> connection_infos = view.getConnections();
+
+    std::cout << std::endl << "Topics available:" << std::endl;
+    for (auto &info : connection_infos) {
+        std::cout << "\t" << info->topic << std::endl;
+    }
+    bag.close();
+
+    std::vector<std::string> topics = {cam_pose_topic};
+    if (!stream) topics.push_back(event_topic);
+    for (auto &p : obj_pose_topics) topics.push_back(p.second);
+    if (with_images) topics.push_back(img_topic);
+
+    ParallelBagReader<BagPart> reader(bag_name, topics, n_threads);
+    auto parts = reader.read([&](const rosbag::MessageInstance &m, BagPart &part) {
+        auto &data = part.data;
+        if (m.getTopic() == cam_pose_topic) {
+            auto msg = m.instantiate<vicon::Subject>();
+            if (msg == NULL) return;
+            data.cam_poses.push_back(Pose(msg->header.stamp, *msg));
+            return;
+        }
+
+        for (auto &p : obj_pose_topics) {
+            if (m.getTopic() != p.second) continue;
+            auto msg = m.instantiate<vicon::Subject>();
+            if (msg == NULL) break;
+            if (msg->occluded) break;
+            data.obj_poses[p.first].push_back(Pose(msg->header.stamp, *msg));
+            data.obj_cloud_to_vicon_tf[p.first] = *msg;
+            break;
+        }
+
+        if (m.getTopic() == event_topic) {
+            auto msg = m.instantiate<dvs_msgs::EventArray>();
+            if (msg == NULL) return;
+            part.has_event_messages = true;
+            data.res_x = msg->height;
+            data.res_y = msg->width;
+
+            for (auto &e : msg->events) {
+                if (part.events.size() == 0) {
+                    part.first_event_ts = e.ts;
+                    data.first_event_message_ts = m.getTime();
+                } else if (e.ts < part.last_event_ts) {
+                    part.unsorted.emplace_back(part.events.size(), part.last_event_ts, e.ts);
+                }
+                part.last_event_ts = e.ts;
+
+                part.events.push_back(e.y, e.x, e.ts.toNSec(), e.polarity ? 1 : 0);
+            }
+
+            return;
+        }
+
+        if (with_images && (m.getTopic() == img_topic)) {
+            auto msg = m.instantiate<sensor_msgs::Image>();
+            data.images.push_back(stream ? cv::Mat() : cv_bridge::toCvShare(msg, "bgr8")->image);
+            data.image_ts.push_back(msg->header.stamp);
+        }
+    });
+
+    uint64_t n_events = 0;
+    for (auto &part : parts) n_events += part.events.size();
+    out.events.reserve(n_events);
+
+    ros::Time first_event_ts;
+    ros::Time last_event_ts;
+    for (auto &part : parts) {
+        auto &data = part.data;
+        if (part.has_event_messages) {
+            out.res_x = data.res_x;
+            out.res_y = data.res_y;
+        }
+
+        if (part.events.size() > 0) {
+            uint64_t id = out.events.size();
+            if (id == 0) {
+                first_event_ts = part.first_event_ts;
+                out.first_event_message_ts = data.first_event_message_ts;
+            } else if (part.first_event_ts < last_event_ts) {
+                part.unsorted.emplace(part.unsorted.begin(), 0, last_event_ts, part.first_event_ts);
+            }
+            last_event_ts = part.last_event_ts;
+
+            for (auto &u : part.unsorted) {
+                std::cout << _red("Events are not sorted! ")
+                          << id + std::get<0>(u) << ": " << std::get<1>(u) << " -> "
+                          << std::get<2>(u) << std::endl;
+            }
+
+            part.events.append_to(out.events);
+        }
+
+        out.cam_poses.insert(out.cam_poses.end(), data.cam_poses.begin(), data.cam_poses.end());
+        for (auto &obj_poses : data.obj_poses) {
+            auto &poses = out.obj_poses[obj_poses.first];
+            poses.insert(poses.end(), obj_poses.second.begin(), obj_poses.second.end());
+        }
+
+        for (auto &s : data.obj_cloud_to_vicon_tf)
+            out.obj_cloud_to_vicon_tf[s.first] = s.second;
+
+        out.images.insert(out.images.end(), data.images.begin(), data.images.end());
+        out.image_ts.insert(out.image_ts.end(), data.image_ts.begin(), data.image_ts.end());
+        part = BagPart();
+    }
+
+    // The first event message is enough for the resolution and time offsets
+    if (stream) {
+        bag.open(bag_name, rosbag::bagmode::Read);
+        rosbag::View event_view(bag, rosbag::TopicQuery(event_topic));
+        for (auto &m : event_view) {
+            auto msg = m.instantiate<dvs_msgs::EventArray>();
+            if (msg == NULL || msg->events.size() == 0) continue;
+            out.res_x = msg->height;
+            out.res_y = msg->width;
+            first_event_ts = msg->events[0].ts;
+            out.first_event_message_ts = m.getTime();
+            break;
+        }
+        bag.close();
+    }
+
+    // Event timestamps relative to the first event
+    out.events.subtract_time(first_event_ts.toNSec());
+    return first_event_ts;
+}
+
+
+// Everything needed to construct a DatasetFrame, from the timestamp alignment
+struct FrameSpec {
+    long int cam_tj_id;
+    double ref_ts;
+    unsigned long int frame_id;
+    uint64_t event_low, event_high;
+    std::map<int, long int> obj_tj_ids;
+};
+
+
+// Construct a frame from its spec; event slice ids are looked up in the event array of the dataset
+void make_frame(std::shared_ptr<Dataset> dataset, std::vector<DatasetFrame> &frames, const FrameSpec &spec,
+                bool with_images) {
+    frames.emplace_back(dataset, spec.cam_tj_id, spec.ref_ts, spec.frame_id);
+    auto &frame = frames.back();
+
+    frame.add_event_slice_ids(spec.event_low, spec.event_high);
+    if (with_images) frame.add_img(dataset->images[spec.frame_id]);
+    for (auto &obj : spec.obj_tj_ids)
+        frame.add_object_pos_id(obj.first, obj.second);
+}
+
+
+// Stage sizes of write_frames()
+struct WriteConfig {
+    size_t incremental = 0;        // keyframe interval of the incremental background rendering; 0 - off
+    size_t n_render = 0;           // frames rendered at once; 0 - the thread pool size
+    size_t n_encode = 0;           // PNG encoding threads; 0 - half of the cores
+    size_t n_writer = 0;           // events.txt formatting threads; 0 - all cores
+};
+
+
+// Generate, save and release a batch of frames; frame metadata goes to meta_file.
+// Rendering, PNG encoding and writing run as a pipeline with bounded queues in
+// between, so frames reach the disk as soon as they are ready: up to n_render
+// frames are rendered at once on the shared thread pool, n_encode threads
+// compress the images and one thread writes them, with the metadata in frame order.
+// With incremental rendering the frames are split into chains of 'incremental'
+// frames, each rendered in order by one pool task with its own DepthWarper
+// (the first frame of a chain is its keyframe); up to n_render chains run at once
+void write_frames(std::shared_ptr<Dataset> dataset, std::vector<DatasetFrame> &frames, std::ofstream &meta_file,
+                  const WriteConfig &cfg, bool progress = false) {
+    size_t n_render = (cfg.n_render > 0) ? cfg.n_render : ThreadPool::shared().size();
+    size_t n_encode = (cfg.n_encode > 0) ? cfg.n_encode : std::max(std::thread::hardware_concurrency() / 2, 1u);
+
+    struct EncodedFrame {
+        size_t id;
+        DatasetFrame::EncodedImages images;
+        std::string meta;
+    };
+
+    BoundedQueue<size_t> rendered(2 * n_encode);
+    BoundedQueue<EncodedFrame> encoded(2 * n_encode);
+
+    std::vector<std::thread> encoders;
+    for (size_t t = 0; t < n_encode; ++t) {
+        encoders.emplace_back([&]() {
+            size_t i;
+            while (rendered.pop(i)) {
+                auto &frame = frames[i];
+                EncodedFrame e = {i, frame.encode_gt_images(), frame.as_dict()};
+                frame.depth.release();
+                frame.mask.release();
+                frame.img.release();
+                encoded.push(std::move(e));
+            }
+        });
+    }
+
+    std::thread writer([&]() {
+        std::map<size_t, std::string> meta;
+        size_t next = 0;
+        EncodedFrame e;
+        while (encoded.pop(e)) {
+            DatasetFrame::write_images(dataset->gt_folder, e.images);
+            meta[e.id] = std::move(e.meta);
+            for (auto it = meta.begin(); it != meta.end() && it->first == next; it = meta.erase(it), ++next) {
+                meta_file << it->second << ",\n\n";
+                if (progress && next % 10 == 0)
+                    std::cout << "\r\tWritten\t" << next + 1 << "\t/\t" << frames.size() << "\t" << std::flush;
+            }
+        }
+    });
+
+    // Rendering units: single frames, or keyframe chains
+    size_t chain = std::max(cfg.incremental, size_t(1));
+    size_t n_units = (frames.size() + chain - 1) / chain;
+    std::vector<std::future<void>> chains(cfg.incremental > 0 ? n_units : 0);
+    auto submit = [&](size_t k) {
+        if (cfg.incremental == 0) {
+            frames[k].generate_async();
+            return;
+        }
+        chains[k] = ThreadPool::shared().submit([&frames, k, chain]() {
+            DepthWarper warper;
+            for (size_t i = k * chain; i < std::min((k + 1) * chain, frames.size()); ++i)
+                frames[i].generate(1, &warper);
+        });
+    };
+    auto join = [&](size_t k) {
+        if (cfg.incremental == 0) frames[k].join();
+        else if (chains[k].valid()) chains[k].get();
+    };
+
+    // A failed frame stops the rendering; the pipeline is still shut down
+    // before the error is passed on
+    std::exception_ptr error;
+    size_t submitted = 0;
+    for (size_t k = 0; k < n_units; ++k) {
+        try {
+            for (; submitted < n_units && submitted < k + n_render; ++submitted)
+                submit(submitted);
+            join(k);
+        } catch (...) {
+            error = std::current_exception();
+            break;
+        }
+        for (size_t i = k * chain; i < std::min((k + 1) * chain, frames.size()); ++i)
+            rendered.push(i);
+    }
+
+    // The pool tasks still running refer to the frames
+    for (size_t k = 0; error && k < submitted; ++k) {
+        try {
+            join(k);
+        } catch (...) {}
+    }
+
+    rendered.close();
+    for (auto &t : encoders) t.join();
+    encoded.close();
+    writer.join();
+
+    frames.clear();
+    if (error) std::rethrow_exception(error);
+}
+
+
+// Out-of-core generation: events and images are read from the bag in a second
+// sequential pass, and frames are generated in windows of 'window' seconds.
+// Only the events of the current window (plus the slice width) and the images
+// of pending frames are kept in memory; events are written out as they are read.
+// Returns the number of events
+uint64_t stream_frames(std::shared_ptr<Dataset> dataset, std::string bag_name, std::string event_topic, std::string img_topic,
+                       bool with_images, ros::Time first_event_ts, size_t images_dropped,
+                       std::vector<FrameSpec> &specs, double window, float event_index_ms, std::ofstream &meta_file,
+                       const WriteConfig &cfg, bool progress = false) {
+    auto &event_array = dataset->event_array;
+    auto &images = dataset->images;
+    event_array.clear();
+
+    EventTxtWriter txt_writer(dataset->gt_folder + "/events.txt", 1, 2 * cfg.n_writer);
+    EventBinWriter bin_writer(dataset->gt_folder + "/events.bin", EventBinWriter::UNKNOWN_SIZE, FROM_MS(1),
+                              dataset->get_rectification());
+
+    // Frames are generated once the events past their slice have been read
+    double event_correction = dataset->get_time_offset_event_to_host_correction();
+    double lookahead = dataset->slice_width / 2.0 + std::fabs(event_correction);
+    double window_end = window;
+    size_t next_spec = 0;
+    uint64_t n_events = 0, image_id = 0;
+    std::vector<DatasetFrame> frames;
+
+    auto process = [&](bool last) {
+        event_array.build_time_index(FROM_MS(event_index_ms));
+
+        // All remaining frames are processed at the end of the bag, even if their image is missing
+        while (next_spec < specs.size() && (last || specs[next_spec].ref_ts < window_end)) {
+            auto &spec = specs[next_spec];
+            if (!last && with_images && images[spec.frame_id].empty()) break;
+            if (event_array.size() > 0) make_frame(dataset, frames, spec, with_images);
+            if (with_images) images[spec.frame_id] = cv::Mat();
+            next_spec ++;
+        }
+
+        write_frames(dataset, frames, meta_file, cfg);
+        if (progress) std::cout << "\r\tWritten " << next_spec << "\t/\t" << specs.size() << "\t" << std::flush;
+
+        // Keep one event before the slice of the next frame, for the nearest-event lookup
+        if (next_spec >= specs.size() || event_array.size() == 0) return;
+        double ts_low = specs[next_spec].ref_ts - event_correction - dataset->slice_width / 2.0;
+        size_t first = TimeSlice(event_array).find_nearest(ts_low, 0);
+        if (first > 0) first --;
+        if (first == 0) return;
+
+        EventArray rest;
+        rest.reserve(event_array.size() - first);
+        for (size_t i = first; i < event_array.size(); ++i)
+            rest.push_back(event_array.get_x(i), event_array.get_y(i), event_array.get_ts(i), event_array.get_polarity(i));
+        event_array = std::move(rest);
+    };
+
+    std::vector<std::string> topics = {event_topic};
+    if (with_images) topics.push_back(img_topic);
+
+    rosbag::Bag bag;
+    bag.open(bag_name, rosbag::bagmode::Read);
+    rosbag::View view(bag, rosbag::TopicQuery(topics));
+    for (auto &m : view) {
+        if (with_images && (m.getTopic() == img_topic)) {
+            uint64_t id = image_id ++;
+            if (id < images_dropped || id - images_dropped >= images.size()) continue;
+            auto msg = m.instantiate<sensor_msgs::Image>();
+            images[id - images_dropped] = cv_bridge::toCvShare(msg, "bgr8")->image.clone();
+            continue;
+        }
+
+        auto msg = m.instantiate<dvs_msgs::EventArray>();
+        if (msg == NULL) continue;
+        for (auto &e : msg->events) {
+            ull ts = e.ts.toNSec() - first_event_ts.toNSec();
+            txt_writer.push_back(e.x, e.y, ts, e.polarity ? 1 : 0);
+            bin_writer.push_back(e.x, e.y, ts, e.polarity ? 1 : 0);
+            event_array.push_back(e.y, e.x, ts, e.polarity ? 1 : 0);
+        }
+        n_events += msg->events.size();
+
+        while (event_array.size() > 0 && event_array.get_ts_sec(event_array.size() - 1) >= window_end + lookahead) {
+            process(false);
+            window_end += window;
+        }
+    }
+    bag.close();
+
+    process(true);
+    std::cout << std::endl << _green("Streamed ") << n_events << _green(" events") << std::endl;
+
+    txt_writer.close();
+    bin_writer.close();
+    event_array.clear();
+    return n_events;
+}
+
+
+std::string sequence_bag_path(std::string dataset_folder) {
+    std::string bag_name = boost::filesystem::path(dataset_folder).stem().string();
+    if (bag_name == ".") {
+        bag_name = boost::filesystem::path(dataset_folder).parent_path().stem().string();
+    }
+
+    auto bag_name_path = boost::filesystem::path(dataset_folder);
+    bag_name_path /= (bag_name + ".bag");
+    return bag_name_path.string();
+}
+
+
+int run_sequence(const SequenceParams &p, ModelStore &models, SequenceStats *stats) {
+    auto wall_start = std::chrono::steady_clock::now();
+    std::string dataset_folder = p.folder;
+    if (dataset_folder == "") {
+        std::cerr << "No dataset folder specified!" << std::endl;
+        return -1;
+    }
+
+    int show = p.show;
+    bool use_cache = p.use_cache;
+    bool with_images = p.with_images;
+
+    auto dataset = std::make_shared<Dataset>();
+    dataset->lod = p.lod;
+    dataset->mesh = p.mesh;
+    dataset->rectify = p.rectify;
+
+    // PNG compression of the written images: zlib level and strategy name (see Dataset::png_strategy_by_name)
+    dataset->png_compression = p.png_compression;
+    if (p.png_strategy != "") {
+        dataset->png_strategy = Dataset::png_strategy_by_name(p.png_strategy);
+        if (dataset->png_strategy < 0) {
+            std::cerr << "Unknown PNG strategy '" << p.png_strategy
+                      << "', expected default / filtered / huffman / rle / fixed" << std::endl;
+            return -1;
+        }
+    }
+
+    // Keyframe interval for the incremental background rendering (0 renders every
+    // frame from scratch), frames rendered at once and PNG encoding threads of the
+    // output pipeline; 0 - automatic
+    WriteConfig write_cfg;
+    write_cfg.incremental = std::max(p.incremental, 0);
+    write_cfg.n_render = std::max(p.render_threads, 0);
+    write_cfg.n_encode = std::max(p.encode_threads, 0);
+    write_cfg.n_writer = std::max(p.writer_threads, 0);
+
+    // Window length in seconds for the out-of-core mode; 0 keeps the whole recording in memory
+    bool stream = p.window > 0;
+    if (stream) {
+        std::cout << _yellow("Streaming in windows of ") << p.window << _yellow(" s: the cache and 'show' are not used") << std::endl;
+        use_cache = false;
+        show = -1;
+    }
+
+    if (with_images)
+        std::cout << _yellow("With 'with_images' option, the datased will be generated at image framerate.") << std::endl;
+
+    // -- parse the dataset folder
+    std::string bag_name = sequence_bag_path(dataset_folder);
+    std::cout << _blue("Procesing bag file: ") << bag_name << std::endl;
+
+    // Read datasset configuration files
+    if (!dataset->init(dataset_folder))
+        return -1;
+
+    // The models are not moved: the pose of the background is applied with dataset->bg_E
+    // and the vicon alignment of the objects with dataset->obj_cloud_tf when rendering
+    if (!p.no_background) {
+        dataset->background = models.get_background();
+    }
+
+    std::map<int, std::string> obj_pose_topics;
+    for (auto &t : p.obj_pose_topics) {
+        if (dataset->enabled_objects.find(t.first) == dataset->enabled_objects.end()) continue;
+        dataset->clouds[t.first] = models.get_object(t.first);
+        obj_pose_topics[t.first] = t.second;
+    }
+
+    // Extract topics from bag, or load them from the cache of a previous run
+    DecodedBag decoded;
+    std::string cache_folder = dataset_folder + "/.datagen_cache";
+    std::map<std::string, std::string> cache_params = {{"cam_pose_topic", p.cam_pose_topic},
+        {"event_topic", p.event_topic}, {"img_topic", p.img_topic}, {"with_images", std::to_string(with_images)}};
+    for (auto &t : obj_pose_topics)
+        cache_params["obj_pose_topic_" + std::to_string(t.first)] = t.second;
+    std::string cache_key = DatasetCache::make_key(bag_name, cache_params);
+
+    ros::Time first_event_ts;
+    if (!use_cache || !DatasetCache::load(cache_folder, cache_key, decoded)) {
+        first_event_ts = read_bag(bag_name, p.cam_pose_topic, p.event_topic, p.img_topic, obj_pose_topics, with_images,
+                                  std::max(p.bag_threads, 0), stream, decoded);
+        if (use_cache) DatasetCache::save(cache_folder, cache_key, decoded);
+    }
+
+    auto &cam_tj  = dataset->cam_tj;
+    auto &obj_tjs = dataset->obj_tjs;
+    auto &images = dataset->images;
+    auto &image_ts = dataset->image_ts;
+    auto &obj_cloud_to_vicon_tf = decoded.obj_cloud_to_vicon_tf;
+
+    auto pose_offset = ros::Duration(dataset->get_time_offset_pose_to_host());
+    for (auto &pose : decoded.cam_poses) {
+        pose.ts = pose.ts + pose_offset;
+        cam_tj.add(pose);
+    }
+
+    for (auto &obj_poses : decoded.obj_poses) {
+        for (auto &pose : obj_poses.second) {
+            pose.ts = pose.ts + pose_offset;
+            obj_tjs[obj_poses.first].add(pose);
+        }
+    }
+
+    auto image_offset = ros::Duration(dataset->get_time_offset_image_to_host());
+    images = std::move(decoded.images);
+    for (auto &ts : decoded.image_ts)
+        image_ts.push_back(ts + image_offset);
+
+    if (with_images && images.size() == 0) {
+        std::cout << _red("No images found! Reverting 'with_images' to 'false'") << std::endl;
+        with_images = false;
+    }
+
+    if (decoded.res_x > 0 || decoded.res_y > 0) {
+        dataset->res_x = decoded.res_x;
+        dataset->res_y = decoded.res_y;
+    }
+
+    // Event timestamps are already relative to the first event
+    auto &event_array = dataset->event_array;
+    event_array = std::move(decoded.events);
+    uint64_t n_events = event_array.size();
+    ros::Time first_event_message_ts = decoded.first_event_message_ts;
+
+    if (!stream) std::cout << _green("Read ") << n_events << _green(" events") << std::endl;
+    std::cout << std::endl << _green("Read ") << cam_tj.size() << _green(" camera poses and ") << std::endl;
+    for (auto &obj_tj : obj_tjs) {
+        if (obj_tj.second.size() == 0) continue;
+        std::cout << "\t" << obj_tj.second.size() << _blue(" poses for object ") << obj_tj.first << std::endl;
+        if (!obj_tj.second.check()) {
+            std::cout << "\t\t" << _red("Check failed!") << std::endl;
+        }
+        if (dataset->clouds.find(obj_tj.first) == dataset->clouds.end()) {
+            std::cout << "\t\t" << _red("No pointcloud for trajectory! ") << "oid = " << obj_tj.first << std::endl;
+            continue;
+        }
+        dataset->obj_cloud_tf[obj_tj.first] = dataset->clouds[obj_tj.first]->cloud_to_vicon_tf(obj_cloud_to_vicon_tf[obj_tj.first]);
+    }
+
+    // Force the first timestamp of the event cloud to be 0
+    // trajectories
+    auto time_offset = first_event_message_ts + ros::Duration(dataset->get_time_offset_event_to_host());
+    cam_tj.subtract_time(time_offset);
+    for (auto &obj_tj : obj_tjs)
+        obj_tj.second.subtract_time(time_offset);
+
+    // Calibration and pose filtering, which the frames only read
+    dataset->apply_settings();
+
+    // images
+    size_t images_dropped = 0;
+    while(image_ts.size() > 0 && *image_ts.begin() < time_offset) {
+        image_ts.erase(image_ts.begin());
+        images.erase(images.begin());
+        images_dropped ++;
+    }
+
+    for (uint64_t i = 0; i < image_ts.size(); ++i)
+        image_ts[i] = ros::Time((image_ts[i] - time_offset).toSec() < 0 ? 0 : (image_ts[i] - time_offset).toSec());
+    // events
+    event_array.build_time_index(FROM_MS(p.event_index_ms));
+
+    std::cout << std::endl << "Removing time offset: " << _green(std::to_string(time_offset.toSec()))
+              << std::endl << std::endl;
+
+    // Align the timestamps
+    double start_ts = 0.2;
+    unsigned long int frame_id_real = 0;
+    double dt = 1.0 / p.fps;
+    long int cam_tj_id = 0;
+    std::map<int, long int> obj_tj_ids;
+    std::vector<FrameSpec> specs;
+    uint64_t event_low = 0, event_high = 0;
+    while (true) {
+        if (with_images) {
+            if (frame_id_real >= image_ts.size()) break;
+            start_ts = image_ts[frame_id_real].toSec();
+        }
+
+        while (cam_tj_id < cam_tj.size() && cam_tj[cam_tj_id].ts.toSec() < start_ts) cam_tj_id ++;
+        for (auto &obj_tj : obj_tjs)
+            while (obj_tj_ids[obj_tj.first] < obj_tj.second.size()
+                   && obj_tj.second[obj_tj_ids[obj_tj.first]].ts.toSec() < start_ts) obj_tj_ids[obj_tj.first] ++;
+
+        start_ts += dt;
+
+        bool done = false;
+        if (cam_tj_id >= cam_tj.size()) done = true;
+        for (auto &obj_tj : obj_tjs)
+            if (obj_tj.second.size() > 0 && obj_tj_ids[obj_tj.first] >= obj_tj.second.size()) done = true;
+        if (done) break;
+
+        auto ref_ts = (with_images ? image_ts[frame_id_real].toSec() : cam_tj[cam_tj_id].ts.toSec());
+        uint64_t ts_low  = (ref_ts < dataset->slice_width) ? 0 : (ref_ts - dataset->slice_width / 2.0) * 1000000000;
+        uint64_t ts_high = (ref_ts + dataset->slice_width / 2.0) * 1000000000;
+        while (event_low  + 1 < event_array.size() && event_array.get_ts(event_low)  < ts_low)  event_low ++;
+        while (event_high + 1 < event_array.size() && event_array.get_ts(event_high) < ts_high) event_high ++;
+
+        double max_ts_err = 0.0;
+        for (auto &obj_tj : obj_tjs) {
+            if (obj_tj.second.size() == 0) continue;
+            double ts_err = std::fabs(ref_ts - obj_tj.second[obj_tj_ids[obj_tj.first]].ts.toSec());
+            if (ts_err > max_ts_err) max_ts_err = ts_err;
+        }
+
+        if (max_ts_err > 0.005) {
+            std::cout << _red("Trajectory timestamp misalignment: ") << max_ts_err << " skipping..." << std::endl;
+            frame_id_real ++;
+            continue;
+        }
+
+        specs.push_back({cam_tj_id, ref_ts, frame_id_real, event_low, event_high, {}});
+        for (auto &obj_tj : obj_tjs)
+            if (obj_tj.second.size() > 0) specs.back().obj_tj_ids[obj_tj.first] = obj_tj_ids[obj_tj.first];
+
+        if (p.verbose) {
+            std::cout << frame_id_real << ": " << cam_tj[cam_tj_id].ts
+                      << " (" << cam_tj_id << "[" << cam_tj[cam_tj_id].occlusion * 100 << "%])";
+            for (auto &obj_tj : obj_tjs) {
+                if (obj_tj.second.size() == 0) continue;
+                std::cout << " " << obj_tj.second[obj_tj_ids[obj_tj.first]].ts << " (" << obj_tj_ids[obj_tj.first]
+                          << "[" << obj_tj.second[obj_tj_ids[obj_tj.first]].occlusion * 100 <<  "%])";
+            }
+            std::cout << std::endl;
+        }
+
+        frame_id_real ++;
+    }
+
+    std::cout << _blue("\nTimestamp alignment done") << std::endl;
+    std::cout << "\tDataset contains " << specs.size() << " frames" << std::endl;
+
+    // In the streaming mode frames are constructed window by window
+    std::vector<DatasetFrame> frames;
+    for (uint64_t i = 0; i < specs.size() && !stream; ++i)
+        make_frame(dataset, frames, specs[i], with_images);
+
+    // Visualization
+    int step = std::max(int(frames.size()) / show, 1);
+    for (int i = 0; i < frames.size() && show > 0; i += step) {
+        frames[i].show();
+    }
+    if (show > 0) {
+        DatasetFrame::visualization_spin();
+    }
+
+    if (show == -2)
+        FrameSequenceVisualizer fsv(frames);
+
+    // Exit if we are running in the visualization mode
+    if (!p.generate) {
+        return 0;
+    }
+
+    // Create / clear ground truth folder
+    dataset->create_ground_truth_folder();
+    if (dataset->rectify) {
+        std::cout << _yellow("Building the undistortion tables") << std::endl;
+        dataset->get_rectification();
+    }
+
+    // Project the clouds and save the masks / depth maps as they are generated
+    std::cout << std::endl << _yellow("Generating and writing depth and mask ground truth") << std::endl;
+    std::string meta_fname = dataset->gt_folder + "/meta.txt";
+    std::ofstream meta_file(meta_fname, std::ofstream::out);
+    meta_file << "{\n";
+    meta_file << dataset->meta_as_dict() + "\n";
+    meta_file << ", 'frames': [\n";
+    if (stream) {
+        n_events = stream_frames(dataset, bag_name, p.event_topic, p.img_topic, with_images, first_event_ts,
+                                 images_dropped, specs, p.window, p.event_index_ms, meta_file, write_cfg, p.verbose);
+    } else {
+        write_frames(dataset, frames, meta_file, write_cfg, p.verbose);
+    }
+    meta_file << "]\n";
+    std::cout << std::endl;
+
+    std::cout << std::endl << _yellow("Writing full trajectory") << std::endl;
+    meta_file << ", 'full_trajectory': [\n";
+    for (uint64_t i = 0; i < dataset->cam_tj.size(); ++i) {
+        DatasetFrame frame(dataset, i, dataset->cam_tj[i].ts.toSec(), -1);
+
+        for (auto &obj_tj : dataset->obj_tjs) {
+            if (obj_tj.second.size() == 0) continue;
+            frame.add_object_pos_id(obj_tj.first, std::min(i, obj_tj.second.size() - 1));
+        }
+
+        meta_file << frame.as_dict() << ",\n\n";
+
+        if (p.verbose && i % 10 == 0) {
+            std::cout << "\r\tWritten " << i + 1 << "\t/\t" << dataset->cam_tj.size() << "\t" << std::flush;
+        }
+    }
+    meta_file << "]\n";
+    std::cout << std::endl;
+
+    meta_file << "\n}\n";
+    meta_file.close();
+
+    // Save events.txt / events.bin; already written in the streaming mode
+    if (!stream) {
+        dataset->write_eventstxt(dataset->gt_folder + "/events.txt", write_cfg.n_writer);
+        dataset->write_eventsbin(dataset->gt_folder + "/events.bin");
+    }
+    std::cout << _green("Done!") << std::endl;
+
+    if (stats != nullptr) {
+        stats->frames = specs.size();
+        stats->events = n_events;
+        stats->bag_bytes = boost::filesystem::file_size(bag_name);
+        stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+    }
+    return 0;
+}
@@ -0,0 +1,94 @@
+#ifndef SEQUENCE_H
+#define SEQUENCE_H
+
+#include <map>
+#include <string>
+#include <cstdint>
+
+#include <model_store.h>
+
+
+// Settings of the ground truth generation for one dataset folder; see
+// read_sequence_params() for the parameter names
+struct SequenceParams {
+    std::string folder;
+
+    float fps = 40.0;
+    bool generate = true;
+    int show = -1;
+    bool no_background = false;
+    bool with_images = false;
+
+    float event_index_ms = 1.0;
+    int bag_threads = 0;
+    bool use_cache = true;
+    float window = 0.0;       // seconds; 0 keeps the whole recording in memory
+
+    bool lod = false;
+    bool mesh = false;
+    bool rectify = false;
+    int png_compression = -1;
+    std::string png_strategy = "";
+
+    int incremental = 0;      // keyframe interval of the background rendering; 0 - off
+    int render_threads = 0;   // frames rendered at once; 0 - automatic
+    int encode_threads = 0;   // PNG encoding threads; 0 - automatic
+    int writer_threads = 0;   // events.txt formatting threads; 0 - all cores
+
+    std::string cam_pose_topic = "/vicon/DVS346";
+    std::string event_topic = "/dvs/events";
+    std::string img_topic = "/dvs/image_raw";
+    std::map<int, std::string> obj_pose_topics = {{1, "/vicon/Object_1"}, {2, "/vicon/Object_2"}, {3, "/vicon/Object_3"}};
+
+    bool verbose = true;      // per-frame log and progress
+};
+
+
+// What run_sequence() did, for the throughput reports
+struct SequenceStats {
+    uint64_t frames = 0;
+    uint64_t events = 0;
+    uint64_t bag_bytes = 0;
+    double seconds = 0;
+};
+
+
+// Fill 'p' with get(name, value), which leaves the value alone if the parameter
+// is not set; the names are the private parameters of datagen_offline
+template <class Get> void read_sequence_params(Get get, SequenceParams &p) {
+    get("folder", p.folder);
+    get("fps", p.fps);
+    get("generate", p.generate);
+    get("show", p.show);
+    get("no_bg", p.no_background);
+    get("with_images", p.with_images);
+    get("event_index_ms", p.event_index_ms);
+    get("bag_threads", p.bag_threads);
+    get("cache", p.use_cache);
+    get("window", p.window);
+    get("lod", p.lod);
+    get("mesh", p.mesh);
+    get("rectify", p.rectify);
+    get("png_compression", p.png_compression);
+    get("png_strategy", p.png_strategy);
+    get("incremental", p.incremental);
+    get("render_threads", p.render_threads);
+    get("encode_threads", p.encode_threads);
+    get("writer_threads", p.writer_threads);
+    get("cam_pose_topic", p.cam_pose_topic);
+    get("event_topic", p.event_topic);
+    get("img_topic", p.img_topic);
+    for (auto &t : p.obj_pose_topics)
+        get("obj_pose_topic_" + std::to_string(t.first - 1), t.second);
+}
+
+
+// <folder>/<folder name>.bag
+std::string sequence_bag_path(std::string dataset_folder);
+
+// Generate the ground truth of one dataset folder, as datagen_offline does;
+// returns the exit code
+int run_sequence(const SequenceParams &p, ModelStore &models, SequenceStats *stats = nullptr);
+
+
+#endif // SEQUENCE_H
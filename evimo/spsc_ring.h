@@ -0,0 +1,69 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+
+// Lock-free ring buffer for exactly one producer and one consumer thread.
+// The capacity is rounded up to a power of two. Each side keeps a cached
+// copy of the other side's index, so the shared cache lines are only read
+// when the ring looks full (producer) or empty (consumer)
+template <class T> class SpscRing {
+protected:
+    std::vector<T> items;
+    size_t mask;
+
+    alignas(64) std::atomic<size_t> head; // next item to pop, written by the consumer
+    alignas(64) std::atomic<size_t> tail; // next free slot, written by the producer
+    alignas(64) size_t head_cache;        // producer side
+    alignas(64) size_t tail_cache;        // consumer side
+
+public:
+    SpscRing (size_t capacity_) : head(0), tail(0), head_cache(0), tail_cache(0) {
+        size_t capacity = 1;
+        while (capacity < capacity_) capacity <<= 1;
+        this->items.resize(capacity);
+        this->mask = capacity - 1;
+    }
+
+    SpscRing (const SpscRing&) = delete;
+    SpscRing& operator = (const SpscRing&) = delete;
+
+    inline size_t capacity () const {return this->items.size(); }
+
+    // Approximate when called while the other side is running
+    inline size_t size () const {
+        return this->tail.load(std::memory_order_acquire) - this->head.load(std::memory_order_acquire);
+    }
+
+    // Producer only; false if the ring is full
+    bool push (const T &item) {
+        size_t t = this->tail.load(std::memory_order_relaxed);
+        if (t - this->head_cache == this->items.size()) {
+            this->head_cache = this->head.load(std::memory_order_acquire);
+            if (t - this->head_cache == this->items.size()) return false;
+        }
+
+        this->items[t & this->mask] = item;
+        this->tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only; moves up to n items to dst and returns their number
+    size_t pop (T *dst, size_t n) {
+        size_t h = this->head.load(std::memory_order_relaxed);
+        if (this->tail_cache - h < n)
+            this->tail_cache = this->tail.load(std::memory_order_acquire);
+
+        size_t m = std::min(n, this->tail_cache - h);
+        for (size_t i = 0; i < m; ++i)
+            dst[i] = this->items[(h + i) & this->mask];
+        this->head.store(h + m, std::memory_order_release);
+        return m;
+    }
+};
+
+
+#endif // SPSC_RING_H
@@ -0,0 +1,163 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+
+// Fixed-size work-stealing thread pool: every worker has its own task queue,
+// takes its newest task first and, when it runs out, takes the oldest task
+// submitted from outside of the pool or steals the oldest task of another
+// worker. Tasks submitted by a worker go to its own queue, tasks submitted from
+// outside go to a shared queue and run in the order they were submitted, since
+// their callers usually wait for them in that order.
+// shared() is sized on its first call and lives until exit
+class ThreadPool {
+protected:
+    struct Worker {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    Worker injected; // tasks from outside of the pool, oldest first
+
+    std::mutex sleep_lock;
+    std::condition_variable wake;
+    std::atomic<size_t> pending;
+    bool stop;
+
+public:
+    static constexpr size_t NO_WORKER = size_t(-1);
+
+    ThreadPool (size_t n_threads = 0) : pending(0), stop(false) {
+        if (n_threads == 0) n_threads = std::max(std::thread::hardware_concurrency(), 1u);
+        for (size_t i = 0; i < n_threads; ++i)
+            this->workers.emplace_back(new Worker());
+        for (size_t i = 0; i < n_threads; ++i)
+            this->threads.emplace_back(&ThreadPool::run, this, i);
+    }
+
+    // Finishes the queued tasks first
+    ~ThreadPool () {
+        {
+            std::lock_guard<std::mutex> guard(this->sleep_lock);
+            this->stop = true;
+        }
+        this->wake.notify_all();
+        for (auto &t : this->threads) t.join();
+    }
+
+    ThreadPool (const ThreadPool&) = delete;
+    ThreadPool& operator = (const ThreadPool&) = delete;
+
+    // The first call fixes the size; 0 - the hardware concurrency
+    static ThreadPool &shared (size_t n_threads = 0) {
+        static ThreadPool pool(n_threads);
+        return pool;
+    }
+
+    inline size_t size () const {return this->workers.size(); }
+
+    // Index of the calling thread in this pool, or NO_WORKER
+    size_t worker_id () const {
+        auto &self = ThreadPool::current();
+        return (self.first == this) ? self.second : NO_WORKER;
+    }
+
+    // A T owned by the calling thread, for scratch buffers which are reused by
+    // all the tasks a worker runs; T has to be default-constructible
+    template<class T> static T &local () {
+        thread_local T scratch;
+        return scratch;
+    }
+
+    // The future holds the result, or the exception thrown by f
+    template<class F> auto submit (F f) -> std::future<decltype(f())> {
+        typedef decltype(f()) R;
+        auto task = std::make_shared<std::packaged_task<R()>>(std::move(f));
+        auto ret = task->get_future();
+
+        // Counted before it is queued, so a worker which runs it right away
+        // can not take the counter below zero
+        {
+            std::lock_guard<std::mutex> guard(this->sleep_lock);
+            this->pending ++;
+        }
+
+        size_t id = this->worker_id();
+        auto &queue = (id == NO_WORKER) ? this->injected : *this->workers[id];
+        {
+            std::lock_guard<std::mutex> guard(queue.lock);
+            queue.tasks.emplace_back([task]() {(*task)(); });
+        }
+        this->wake.notify_one();
+        return ret;
+    }
+
+protected:
+    static std::pair<const ThreadPool*, size_t> &current () {
+        thread_local std::pair<const ThreadPool*, size_t> self(nullptr, NO_WORKER);
+        return self;
+    }
+
+    bool pop (size_t id, std::function<void()> &task) {
+        {
+            auto &own = *this->workers[id];
+            std::lock_guard<std::mutex> guard(own.lock);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(this->injected.lock);
+            if (!this->injected.tasks.empty()) {
+                task = std::move(this->injected.tasks.front());
+                this->injected.tasks.pop_front();
+                return true;
+            }
+        }
+
+        for (size_t k = 1; k < this->workers.size(); ++k) {
+            auto &victim = *this->workers[(id + k) % this->workers.size()];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run (size_t id) {
+        ThreadPool::current() = std::make_pair(this, id);
+        std::function<void()> task;
+        while (true) {
+            if (this->pop(id, task)) {
+                this->pending --;
+                task();
+                task = nullptr;
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(this->sleep_lock);
+            this->wake.wait(lock, [this]() {return this->stop || this->pending > 0; });
+            if (this->stop && this->pending == 0) return;
+        }
+    }
+};
+
+
+#endif // THREAD_POOL_H
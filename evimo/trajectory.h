@@ -1,4 +1,5 @@
 #include <valarray>
+#include <type_traits>
 
 #include <common.h>
 
@@ -7,6 +8,17 @@
 #define TRAJECTORY_H
 
 
+// Containers with direct timestamp access (EventStore) skip the iterator in TimeSlice
+template <class T, class = void> struct has_ts_column : std::false_type {};
+template <class T> struct has_ts_column<T, std::void_t<decltype(
+    std::declval<const T&>().get_ts_sec(size_t(0)))>> : std::true_type {};
+
+// Containers with a time index (EventStore) provide their own search hint in TimeSlice
+template <class T, class = void> struct has_index_hint : std::false_type {};
+template <class T> struct has_index_hint<T, std::void_t<decltype(
+    std::declval<const T&>().index_hint(0.0, size_t(0)))>> : std::true_type {};
+
+
 template <class T> class Slice {
 protected:
     T *data;
@@ -51,7 +63,10 @@ public:
 template <class T> class TimeSlice : public Slice<T> {
 protected:
     std::pair<double, double> time_bounds;
-    double get_ts(size_t idx) const {return (this->data->begin() + idx)->get_ts_sec(); }
+    double get_ts(size_t idx) const {
+        if constexpr (has_ts_column<T>::value) return this->data->get_ts_sec(idx);
+        else return (this->data->begin() + idx)->get_ts_sec();
+    }
 
 public:
     TimeSlice(T &vec)
@@ -80,6 +95,9 @@ public:
         if (this->data->size() == 0)
             throw std::string("find_nearest: data container is empty!");
 
+        if constexpr (has_index_hint<T>::value)
+            hint = this->data->index_hint(ts, hint);
+
         if (hint >= this->data->size())
             throw std::string("find_nearest: hint specified is out of bounds!");
 
@@ -239,6 +257,8 @@ public:
         this->poses.push_back(Pose(ts_, pq_));
     }
 
+    void add(const Pose &p) {this->poses.push_back(p); }
+
     size_t size() {return this->poses.size(); }
     auto operator [] (size_t idx) {return this->get_filtered(idx); }
 
@@ -0,0 +1,90 @@
+#ifndef UNDISTORTION_H
+#define UNDISTORTION_H
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <projection.h>
+
+
+// Per-pixel lookup tables between the distorted sensor image and the
+// rectified one (the same pinhole camera without k1..k4), built once per
+// calibration. Pixel coordinates are (row, col) of the ground truth frames,
+// the events.txt x is the column and y is the row. The rectified coordinates
+// of a pixel are those of its center, so with no distortion the rectified
+// event coordinates equal the raw ones
+class UndistortionMap {
+protected:
+    Projector projector;
+    int rows, cols;
+
+    // Rectified events.txt x / y of every sensor pixel; NaN where the
+    // distortion model can not be inverted
+    std::vector<float> rect_x, rect_y;
+
+    // Source sensor pixel of every rectified pixel, for cv::remap
+    cv::Mat map_x, map_y;
+
+public:
+    UndistortionMap () : projector(0, 0, 0, 0, 0, 0, 0, 0), rows(0), cols(0) {}
+
+    inline bool empty () const {return this->rect_x.empty(); }
+
+    // Rebuilds the tables if the calibration or the resolution has changed
+    void update (const Projector &p, int rows_, int cols_) {
+        if (!this->empty() && p == this->projector && rows_ == this->rows && cols_ == this->cols)
+            return;
+
+        this->projector = p;
+        this->rows = rows_;
+        this->cols = cols_;
+        this->rect_x.assign(size_t(rows) * cols, std::numeric_limits<float>::quiet_NaN());
+        this->rect_y.assign(size_t(rows) * cols, std::numeric_limits<float>::quiet_NaN());
+        this->map_x = cv::Mat(rows, cols, CV_32F, cv::Scalar(-1));
+        this->map_y = cv::Mat(rows, cols, CV_32F, cv::Scalar(-1));
+
+        // The frames are flipped in both directions with respect to the
+        // projection: pixel (r, c) is centered at u = rows - r - 0.5, v = cols - c - 0.5
+        for (int r = 0; r < rows; ++r) {
+            for (int c = 0; c < cols; ++c) {
+                float x, y, u, v;
+                if (p.unproject(rows - r - 0.5f, cols - c - 0.5f, x, y)) {
+                    p.project_pinhole(x, y, u, v);
+                    this->rect_x[size_t(r) * cols + c] = cols - v - 0.5f;
+                    this->rect_y[size_t(r) * cols + c] = rows - u - 0.5f;
+                }
+
+                p.unproject_pinhole(rows - r - 0.5f, cols - c - 0.5f, x, y);
+                if (p.project_subpixel(x, y, 1.0f, u, v)) {
+                    this->map_x.at<float>(r, c) = cols - v - 0.5f;
+                    this->map_y.at<float>(r, c) = rows - u - 0.5f;
+                }
+            }
+        }
+    }
+
+    // x, y in the events.txt order; NaN outside of the sensor
+    inline void rectify (uint x, uint y, float &x_rect, float &y_rect) const {
+        if (x >= uint(this->cols) || y >= uint(this->rows)) {
+            x_rect = y_rect = std::numeric_limits<float>::quiet_NaN();
+            return;
+        }
+        x_rect = this->rect_x[size_t(y) * this->cols + x];
+        y_rect = this->rect_y[size_t(y) * this->cols + x];
+    }
+
+    // Rectified copy of a ground truth frame; nearest neighbour, so that depth
+    // and object ids are not blended across object boundaries
+    cv::Mat remap (const cv::Mat &src) const {
+        cv::Mat dst;
+        cv::remap(src, dst, this->map_x, this->map_y, cv::INTER_NEAREST, cv::BORDER_CONSTANT, cv::Scalar(0));
+        return dst;
+    }
+};
+
+
+#endif // UNDISTORTION_H
@@ -0,0 +1,67 @@
+#!/usr/bin/python
+
+# Memory-mapped reader for the 'events.bin' files written by datagen_offline / datagen_online
+# (see EventBinWriter in evimo/event_writer.h for the layout)
+
+import argparse
+import struct
+import numpy as np
+
+
+class EventsBin:
+    def __init__(self, fname):
+        self.mm = np.memmap(fname, dtype=np.uint8, mode='r')
+        magic, self.version, n_sections, self.n_events, self.t0, self.bucket = \
+            struct.unpack_from('<8sIIQQQ', self.mm, 0)
+        if magic != b'EVIMOEVB':
+            raise ValueError(fname + " is not an events.bin file")
+
+        self.sections = {}
+        for i in range(n_sections):
+            name, offset, size = struct.unpack_from('<8sQQ', self.mm, 40 + 24 * i)
+            self.sections[name.rstrip(b'\0').decode()] = (offset, size)
+
+        self.t = self.column('t', np.uint64)
+        self.x = self.column('x', np.uint16)
+        self.y = self.column('y', np.uint16)
+        self.index = self.column('index', np.uint64)
+
+        # Undistorted coordinates, present when generated with _rectify:=true
+        self.x_rect = self.column('x_rect', np.float32) if 'x_rect' in self.sections else None
+        self.y_rect = self.column('y_rect', np.float32) if 'y_rect' in self.sections else None
+
+    def column(self, name, dtype):
+        offset, size = self.sections[name]
+        return np.frombuffer(self.mm, dtype=dtype, count=size // np.dtype(dtype).itemsize, offset=offset)
+
+    def polarity(self, lo=0, hi=None):
+        hi = self.n_events if hi is None else hi
+        offset, _ = self.sections['p']
+        words = np.frombuffer(self.mm, dtype=np.uint8, count=(hi + 7) // 8 - lo // 8, offset=offset + lo // 8)
+        return np.unpackbits(words, bitorder='little')[lo % 8:lo % 8 + hi - lo]
+
+    # Index range [lo, hi) of events with t_lo <= t < t_hi (timestamps in seconds)
+    def find(self, t_lo, t_hi):
+        def lookup(ts):
+            ns = int(ts * 1e9)
+            k = min(max((ns - self.t0) // self.bucket, 0), len(self.index) - 2)
+            lo, hi = int(self.index[k]), int(self.index[k + 1])
+            return lo + int(np.searchsorted(self.t[lo:hi], ns, 'left'))
+        return lookup(t_lo), lookup(t_hi)
+
+    # Nx4 array (t, x, y, p) in the events.txt format
+    def slice(self, t_lo, t_hi):
+        lo, hi = self.find(t_lo, t_hi)
+        return np.stack([self.t[lo:hi] / 1e9, self.x[lo:hi], self.y[lo:hi], self.polarity(lo, hi)], axis=1)
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser()
+    parser.add_argument("file", help="events.bin file")
+    parser.add_argument("--t_lo", type=float, default=0.0, help="Slice start, sec.")
+    parser.add_argument("--t_hi", type=float, default=0.01, help="Slice end, sec.")
+    args = parser.parse_args()
+
+    ev = EventsBin(args.file)
+    print("Events: " + str(ev.n_events) + ", index buckets: " + str(len(ev.index) - 1))
+    print(ev.slice(args.t_lo, args.t_hi))
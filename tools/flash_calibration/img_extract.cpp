@@ -9,6 +9,7 @@
 #include <ctime>
 #include <new>
 #include <cassert>
+#include <chrono>
 #include <unistd.h>
 #include <sys/stat.h>
 
@@ -26,6 +27,9 @@
 #include <dvs_msgs/Event.h>
 #include <dvs_msgs/EventArray.h>
 
+// Multi-threaded bag decoding, shared with evimo
+#include <bag_reader.h>
+
 
 typedef long int lint;
 typedef long long int llint;
@@ -58,6 +62,15 @@ ull min_slice_time = 0; // 0.0 sec
 ull width_slice_time = 1000; // 100 ms
 
 
+// Events of one time interval of the bag, see read_events
+struct EventPart {
+    std::vector<uint> x_arr, y_arr;
+    std::vector<ull>  t_arr;
+    std::vector<bool> p_arr;
+    int resolution_x = -1, resolution_y = -1;
+};
+
+
 bool read_events (std::string fname, std::string tname, double llimit, double hlimit) {
     std::cout << "Reading from file... (" << fname << ")"
               << " topic: " << tname
@@ -87,67 +100,82 @@ bool read_events (std::string fname, std::string tname, double llimit, double hl
         return false;
     }
 
-    ull cnt = 0;
-    ull total_cnt = 0;
-    clock_t begin = std::clock();
+    auto begin = std::chrono::steady_clock::now();
 
+    // The first event of the topic defines the cutoffs
     ros::Time first_event_ts;
     ros::Time cutoff_lo;
     ros::Time cutoff_hi;
 
+    bool first_found = false;
+    rosbag::View topic_view(bag, rosbag::TopicQuery(tname));
+    for (auto &m : topic_view) {
+        auto msg = m.instantiate<dvs_msgs::EventArray>();
+        if (msg == NULL || msg->events.size() == 0) continue;
+        first_event_ts = msg->events[0].ts;
+        first_found = true;
+        break;
+    }
+
     if (llimit < 0) llimit = 0;
-    for (auto &m : view) {
-        if (m.getTopic() == tname) {
+    cutoff_lo = first_event_ts + ros::Duration(llimit);
+    cutoff_hi = first_event_ts + ros::Duration(hlimit);
+
+    bag.close();
+
+    // Decompress and decode consecutive time intervals of the bag in parallel.
+    // Intervals after the one where hlimit is reached are not needed
+    std::vector<EventPart> parts;
+    if (first_found) {
+        ParallelBagReader<EventPart> reader(fname, {tname});
+        parts = reader.read_until([&](const rosbag::MessageInstance &m, EventPart &part) {
             auto msg = m.instantiate<dvs_msgs::EventArray>();
-            if (msg != NULL) {
-                if (total_cnt == 0) {
-                    first_event_ts = msg->events[0].ts;
-                    cutoff_lo = first_event_ts + ros::Duration(llimit);
-                    cutoff_hi = first_event_ts + ros::Duration(hlimit);
-                }
-                total_cnt += msg->events.size();
-
-                if (msg->events[0].ts < cutoff_lo)
-                    continue;
-
-                if (hlimit > 0 && msg->events[msg->events.size() - 1].ts > cutoff_hi)
-                    break;
-
-                resolution_x = msg->height;
-                resolution_y = msg->width;
-                cnt += msg->events.size();
+            if (msg == NULL || msg->events.size() == 0)
+                return true;
+
+            if (msg->events[0].ts < cutoff_lo)
+                return true;
+
+            if (hlimit > 0 && msg->events[msg->events.size() - 1].ts > cutoff_hi)
+                return false;
+
+            part.resolution_x = msg->height;
+            part.resolution_y = msg->width;
+            for (auto &e : msg->events) {
+                part.x_arr.push_back(e.y);
+                part.y_arr.push_back(e.x);
+                part.t_arr.push_back((e.ts - cutoff_lo).toSec() * 1000000000.0);
+                part.p_arr.push_back(e.polarity ? 1 : 0);
             }
-        }
+            return true;
+        });
     }
 
+    // Merge in time order
+    ull cnt = 0;
+    for (auto &part : parts)
+        cnt += part.t_arr.size();
+
     std::cout << "Found " << cnt << " events" << std::endl;
     if (cnt == 0) {
         return false;
     }
 
-    x_arr.reserve(cnt * 1.2);
-    y_arr.reserve(cnt * 1.2);
-    t_arr.reserve(cnt * 1.2);
-    p_arr.reserve(cnt * 1.2);
-
-    for (auto &m : view) {
-        if (m.getTopic() == tname) {
-            auto msg = m.instantiate<dvs_msgs::EventArray>();
-            if (msg != NULL) {
-                if (msg->events[0].ts < cutoff_lo)
-                    continue;
-
-                if (hlimit > 0 && msg->events[msg->events.size() - 1].ts > cutoff_hi)
-                    break;
-
-                for (auto &e : msg->events) {
-                    x_arr.push_back(e.y);
-                    y_arr.push_back(e.x);
-                    t_arr.push_back((e.ts - cutoff_lo).toSec() * 1000000000.0);
-                    p_arr.push_back(e.polarity ? 1 : 0);
-                }
-            }
+    x_arr.reserve(cnt);
+    y_arr.reserve(cnt);
+    t_arr.reserve(cnt);
+    p_arr.reserve(cnt);
+
+    for (auto &part : parts) {
+        x_arr.insert(x_arr.end(), part.x_arr.begin(), part.x_arr.end());
+        y_arr.insert(y_arr.end(), part.y_arr.begin(), part.y_arr.end());
+        t_arr.insert(t_arr.end(), part.t_arr.begin(), part.t_arr.end());
+        p_arr.insert(p_arr.end(), part.p_arr.begin(), part.p_arr.end());
+        if (part.resolution_x >= 0) {
+            resolution_x = part.resolution_x;
+            resolution_y = part.resolution_y;
         }
+        part = EventPart();
     }
 
     std::cout << "Populating the lookup table..." << std::endl;
@@ -158,18 +186,17 @@ bool read_events (std::string fname, std::string tname, double llimit, double hl
         if (ts >= target) idx.push_back(i);
     }
 
-    clock_t end = std::clock();
+    auto end = std::chrono::steady_clock::now();
 
     min_actual_time = t_arr[0];
     max_actual_time = t_arr[t_arr.size() - 1];
 
     std::cout << "Read " << cnt << " events, finished" << std::endl << std::flush;
-    std::cout << "Elapsed: " << double(end - begin) / CLOCKS_PER_SEC << " sec." << std::endl << std::flush;
+    std::cout << "Elapsed: " << std::chrono::duration<double>(end - begin).count() << " sec." << std::endl << std::flush;
     std::cout << "Time diff: " << t_arr[t_arr.size() - 1] - t_arr[0] << std::endl << std::flush;
     std::cout << "Time diff: " << (long double)(t_arr[t_arr.size() - 1] - t_arr[0]) / 1000000000.0
               << " sec." << std::endl << std::endl << std::flush;
 
-    bag.close();
     return true;
 }
 